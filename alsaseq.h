@@ -0,0 +1,255 @@
+/******************************************************
+ *
+ * alsaseq - ALSA sequencer ports for [midisettings]
+ * Copyright (C) 2010-2019 IOhannes m zmölnig
+ *
+ *   forum::für::umläute
+ *
+ *   institute of electronic music and acoustics (iem)
+ *   university of music and dramatic arts, graz (kug)
+ *
+ *
+ ******************************************************
+ *
+ * license: GNU General Public License v.3 or later
+ *
+ ******************************************************/
+
+/* with ALSA-MIDI, Pd only creates its own (virtual) sequencer ports,
+ * which have to be connected to the hardware/software ports.
+ * we open a sequencer client of our own, that enumerates the ports and
+ * (un)subscribes Pd's ports directly (like 'aconnect' does)
+ *
+ * needs mediasettings.h (and HAVE_ALSA, else this is a no-op)
+ */
+#if defined(__linux__) && defined(HAVE_ALSA)
+# define MEDIASETTINGS_ALSASEQ 1
+# include <alsa/asoundlib.h>
+
+/* the name of Pd's sequencer client */
+#define ALSASEQ_PDCLIENT "Pure Data"
+
+typedef struct _alsaseq_port {
+  int client, port;
+  unsigned int caps;    /* SND_SEQ_PORT_CAP_* */
+  t_symbol*name;        /* '<client name>:<port name>' (made unique) */
+  t_symbol*address;     /* '<client>:<port>' */
+} t_alsaseq_port;
+
+/**
+ * alsaseq: a snapshot of all (connectable) sequencer ports
+ * it is re-taken when a client/port comes or goes (as announced by the
+ * sequencer), or when the (MIDI) device cache is invalidated
+ */
+typedef struct _alsaseq {
+  snd_seq_t*seq;          /* our own client */
+  int failed;             /* don't retry to open the sequencer */
+
+  t_alsaseq_port*ports;
+  unsigned int count, size;
+  int pdclient;           /* Pd's client (or -1) */
+  t_symkeys names;        /* port name -> index into ports */
+  t_devindex index;
+  int valid;
+  unsigned int generation;
+} t_alsaseq;
+
+static int alsaseq_open(t_alsaseq*seq) {
+  int err;
+  if(seq->seq)
+    return 1;
+  if(seq->failed)
+    return 0;
+  err=snd_seq_open(&seq->seq, "default", SND_SEQ_OPEN_DUPLEX, SND_SEQ_NONBLOCK);
+  if(err<0) {
+    seq->seq=0;
+    seq->failed=1;
+    verbose(1, "unable to open the ALSA sequencer: %s", snd_strerror(err));
+    return 0;
+  }
+  snd_seq_set_client_name(seq->seq, "midisettings");
+  /* get notified when clients/ports come and go */
+  err=snd_seq_create_simple_port(seq->seq, "announce",
+                                 SND_SEQ_PORT_CAP_WRITE|SND_SEQ_PORT_CAP_NO_EXPORT,
+                                 SND_SEQ_PORT_TYPE_APPLICATION);
+  if(err<0 || snd_seq_connect_from(seq->seq, err, SND_SEQ_CLIENT_SYSTEM, SND_SEQ_PORT_SYSTEM_ANNOUNCE)<0)
+    verbose(1, "unable to watch the ALSA sequencer ports");
+  return 1;
+}
+
+/* close our client and release the snapshot */
+static void alsaseq_free(t_alsaseq*seq) {
+  if(seq->seq)
+    snd_seq_close(seq->seq);
+  seq->seq=0;
+  if(seq->ports)
+    freebytes(seq->ports, seq->size*sizeof(*seq->ports));
+  seq->ports=0;
+  seq->count=seq->size=0;
+  symkeys_free(&seq->names);
+  devindex_free(&seq->index);
+  seq->valid=0;
+}
+
+/* whether Pd's client is <cinfo> */
+static int alsaseq_ispd(const snd_seq_client_info_t*cinfo) {
+  if(strcmp(snd_seq_client_info_get_name(cinfo), ALSASEQ_PDCLIENT))
+    return 0;
+#if SND_LIB_VERSION >= 0x010105
+  /* there might be several Pd's running */
+  if(snd_seq_client_info_get_pid(cinfo)>0 && snd_seq_client_info_get_pid(cinfo)!=getpid())
+    return 0;
+#endif
+  return 1;
+}
+
+static void alsaseq_addport(t_alsaseq*seq, int client, const char*clientname, const snd_seq_port_info_t*pinfo) {
+  char buf[MAXPDSTRING];
+  t_alsaseq_port*port;
+  if(seq->count>=seq->size) {
+    unsigned int size=seq->size?(2*seq->size):32;
+    seq->ports=(t_alsaseq_port*)resizebytes(seq->ports,
+                                           seq->size*sizeof(*seq->ports), size*sizeof(*seq->ports));
+    seq->size=size;
+  }
+  port=seq->ports+seq->count;
+  port->client=client;
+  port->port=snd_seq_port_info_get_port(pinfo);
+  port->caps=snd_seq_port_info_get_capability(pinfo);
+  snprintf(buf, sizeof(buf), "%s:%s", clientname, snd_seq_port_info_get_name(pinfo));
+  port->name=symkeys_add(&seq->names, gensym(buf), seq->count, 1)->name;
+  snprintf(buf, sizeof(buf), "%d:%d", port->client, port->port);
+  port->address=gensym(buf);
+  seq->count++;
+}
+
+/* re-take the snapshot if needed (<generation> is that of the MIDI device cache)
+ * returns 0 if the sequencer is not available */
+static int alsaseq_update(t_alsaseq*seq, const unsigned int generation) {
+  snd_seq_client_info_t*cinfo;
+  snd_seq_port_info_t*pinfo;
+  int self;
+  if(!alsaseq_open(seq))
+    return 0;
+
+  /* any announcement (client/port start/exit/change) invalidates the snapshot */
+  while(snd_seq_event_input_pending(seq->seq, 1)>0) {
+    snd_seq_event_t*ev=0;
+    if(snd_seq_event_input(seq->seq, &ev)<0)
+      break;
+    seq->valid=0;
+  }
+  if(seq->valid && seq->generation == generation)
+    return 1;
+
+  seq->count=0;
+  seq->pdclient=-1;
+  symkeys_clear(&seq->names);
+  self=snd_seq_client_id(seq->seq);
+
+  snd_seq_client_info_alloca(&cinfo);
+  snd_seq_port_info_alloca(&pinfo);
+  snd_seq_client_info_set_client(cinfo, -1);
+  while(snd_seq_query_next_client(seq->seq, cinfo)>=0) {
+    int client=snd_seq_client_info_get_client(cinfo);
+    const char*clientname=snd_seq_client_info_get_name(cinfo);
+    if(self == client || SND_SEQ_CLIENT_SYSTEM == client)
+      continue;
+    if(seq->pdclient<0 && alsaseq_ispd(cinfo))
+      seq->pdclient=client;
+    snd_seq_port_info_set_client(pinfo, client);
+    snd_seq_port_info_set_port(pinfo, -1);
+    while(snd_seq_query_next_port(seq->seq, pinfo)>=0) {
+      unsigned int caps=snd_seq_port_info_get_capability(pinfo);
+      if(caps & SND_SEQ_PORT_CAP_NO_EXPORT)
+        continue;
+      if(!(caps & (SND_SEQ_PORT_CAP_SUBS_READ|SND_SEQ_PORT_CAP_SUBS_WRITE)))
+        continue;
+      alsaseq_addport(seq, client, clientname, pinfo);
+    }
+  }
+  devindex_build(&seq->index, &seq->names);
+  seq->valid=1;
+  seq->generation=generation;
+  return 1;
+}
+
+/* the <n>th input (<writable>) resp. output port of Pd (or NULL) */
+static const t_alsaseq_port*alsaseq_pdport(const t_alsaseq*seq, int writable, unsigned int n) {
+  unsigned int cap=writable?SND_SEQ_PORT_CAP_WRITE:SND_SEQ_PORT_CAP_READ;
+  unsigned int i;
+  for(i=0; i<seq->count; i++) {
+    const t_alsaseq_port*port=seq->ports+i;
+    if(port->client != seq->pdclient || !(port->caps & cap))
+      continue;
+    if(!n--)
+      return port;
+  }
+  return 0;
+}
+
+/* a port given as '<client>:<port>', '<client>' or (a unique part of) its name
+ * returns 0 on success, DEVINDEX_NOTFOUND or DEVINDEX_AMBIGUOUS
+ * (client and port numbers are 8 bit, anything else is not found)
+ */
+static int alsaseq_resolve(const t_alsaseq*seq, const t_atom*a, snd_seq_addr_t*addr) {
+  int client, port, id;
+  char c;
+  if(A_FLOAT == a->a_type) {
+    client=atom_getint(a);
+    if(client<0 || client>255)
+      return DEVINDEX_NOTFOUND;
+    addr->client=(unsigned char)client;
+    addr->port=0;
+    return 0;
+  }
+  if(A_SYMBOL != a->a_type)
+    return DEVINDEX_NOTFOUND;
+  if(2 == sscanf(atom_getsymbol(a)->s_name, "%d:%d%c", &client, &port, &c)) {
+    if(client<0 || client>255 || port<0 || port>255)
+      return DEVINDEX_NOTFOUND;
+    addr->client=(unsigned char)client;
+    addr->port=(unsigned char)port;
+    return 0;
+  }
+  id=devindex_find(&seq->index, &seq->names, atom_getsymbol(a));
+  if(id<0)
+    return id;
+  addr->client=(unsigned char)seq->ports[id].client;
+  addr->port=(unsigned char)seq->ports[id].port;
+  return 0;
+}
+
+/* (un)subscribe <dest> to <sender>; returns 0 on success, else a negative error code */
+static int alsaseq_connect(t_alsaseq*seq, const snd_seq_addr_t*sender, const snd_seq_addr_t*dest, int connect) {
+  snd_seq_port_subscribe_t*subs;
+  if(!alsaseq_open(seq))
+    return -ENODEV;
+  snd_seq_port_subscribe_alloca(&subs);
+  snd_seq_port_subscribe_set_sender(subs, sender);
+  snd_seq_port_subscribe_set_dest(subs, dest);
+  if(connect) {
+    if(!snd_seq_get_port_subscription(seq->seq, subs))
+      return -EEXIST;
+    return snd_seq_subscribe_port(seq->seq, subs);
+  }
+  return snd_seq_unsubscribe_port(seq->seq, subs);
+}
+
+/* calls <fn> for each subscription of the (readable) port <sender> */
+typedef void (*t_alsaseq_subsfn)(void*owner, const snd_seq_addr_t*sender, const snd_seq_addr_t*dest);
+static void alsaseq_subscribers(t_alsaseq*seq, const snd_seq_addr_t*sender, t_alsaseq_subsfn fn, void*owner) {
+  snd_seq_query_subscribe_t*query;
+  if(!alsaseq_open(seq))
+    return;
+  snd_seq_query_subscribe_alloca(&query);
+  snd_seq_query_subscribe_set_root(query, sender);
+  snd_seq_query_subscribe_set_type(query, SND_SEQ_QUERY_SUBS_READ);
+  snd_seq_query_subscribe_set_index(query, 0);
+  while(snd_seq_query_port_subscribers(seq->seq, query)>=0) {
+    fn(owner, sender, snd_seq_query_subscribe_get_addr(query));
+    snd_seq_query_subscribe_set_index(query, snd_seq_query_subscribe_get_index(query)+1);
+  }
+}
+
+#endif /* __linux__ && HAVE_ALSA */
@@ -30,6 +30,11 @@
 #ifndef MAXAUDIOOUTDEV
 # define MAXAUDIOOUTDEV 4
 #endif
+#if MAXAUDIOINDEV > MAXAUDIOOUTDEV
+# define MAXAUDIODEV MAXAUDIOINDEV
+#else
+# define MAXAUDIODEV MAXAUDIOOUTDEV
+#endif
 #ifndef DEFAULTAUDIODEV
 # define DEFAULTAUDIODEV 0
 #endif
@@ -47,14 +52,6 @@
 # define AUDIOSETTINGS_API 0
 #endif
 
-typedef struct _as_drivers {
-  t_symbol*name;
-  int      id;
-
-  struct _as_drivers *next;
-} t_as_drivers;
-
-
 #if AUDIOSETTINGS_API == 1
 void sys_set_audio_api(const int api) {
 #if 0
@@ -82,20 +79,22 @@ void sys_set_audio_api(const int api) {
   sys_set_audio_settings(&as);
 }
 
+static int as_get_audio_api(void) {
+  t_audiosettings as;
+  sys_get_audio_settings(&as);
+  return as.a_api;
+}
+
 static void as_get_audio_devs(
     char *indevlist, int *nindevs,
     char *outdevlist, int *noutdevs,
     int *canmulti, int *cancallback,
     int maxndev, int devdescsize,
-    int *api) {
-  t_audiosettings as;
-  sys_get_audio_settings(&as);
-  if(api)
-    *api = as.a_api;
+    const int api) {
   sys_get_audio_devs(indevlist, nindevs,
       outdevlist, noutdevs,
       canmulti, cancallback,
-      maxndev, devdescsize, as.a_api);
+      maxndev, devdescsize, api);
 }
 
 #elif AUDIOSETTINGS_API == 0
@@ -107,9 +106,9 @@ typedef struct _audiosettings
     int a_nchindev;
     int a_chindevvec[MAXAUDIOINDEV];
     int a_noutdev;
-    int a_outdevvec[MAXAUDIOINDEV];
+    int a_outdevvec[MAXAUDIOOUTDEV];
     int a_nchoutdev;
-    int a_choutdevvec[MAXAUDIOINDEV];
+    int a_choutdevvec[MAXAUDIOOUTDEV];
     int a_srate;
     int a_advance;
     int a_callback;
@@ -120,6 +119,7 @@ static void sys_get_audio_settings(t_audiosettings*parms) {
   int i=0;
   memset(parms, 0, sizeof(t_audiosettings));
   parms->a_callback=-1;
+  parms->a_api=sys_audioapi;
 
   sys_get_audio_params(
       &parms->a_nindev,  parms->a_indevvec,  parms->a_chindevvec,
@@ -139,14 +139,18 @@ static void sys_get_audio_settings(t_audiosettings*parms) {
   parms->a_nchoutdev = parms->a_noutdev;
 }
 
+static int as_get_audio_api(void) {
+  return sys_audioapi;
+}
+
+/* this can only enumerate the devices of the current API */
 static void as_get_audio_devs(
     char *indevlist, int *nindevs,
     char *outdevlist, int *noutdevs,
     int *canmulti, int *cancallback,
     int maxndev, int devdescsize,
-    int *api) {
-  if(api)
-    *api = sys_audioapi;
+    const int api) {
+  (void)api;
   sys_get_audio_devs(indevlist, nindevs,
       outdevlist, noutdevs,
       canmulti, cancallback,
@@ -156,101 +160,132 @@ static void as_get_audio_devs(
 
 static t_class *audiosettings_class;
 
-static t_symbol*s_pdsym=NULL;
-
-t_as_drivers*as_finddriver(t_as_drivers*drivers, const t_symbol*name) {
-  while(drivers) {
-    if(name==drivers->name)return drivers;
-    drivers=drivers->next;
-  }
-  return NULL;
+/* changes that are waiting to be applied */
+typedef struct _as_deferred {
+  t_clock*clock;
+  int scheduled;
+  t_audiosettings params;
+  unsigned int changed;  /* which parameters (1<<t_as_param) of 'params' to apply */
+  double lastapply;      /* logical time of the last re-open */
+  t_float mininterval;   /* msecs */
+} t_as_deferred;
+
+/* the backend calls we keep timings for */
+enum {
+  TIMING_GET_APIS,
+  TIMING_GET_DEVS,
+  TIMING_CLOSE,
+  TIMING_REOPEN,
+  TIMING_DIALOG,
+  TIMING_COUNT
+};
+static const char*as_timing_names[TIMING_COUNT] = {
+  "sys_get_audio_apis",
+  "sys_get_audio_devs",
+  "sys_close_audio",
+  "sys_reopen_audio",
+  "audio-dialog",
+};
+
+/* the state that is shared by all [audiosettings] of a Pd-instance */
+typedef struct _as_instance {
+  t_msinstance i_instance;
+  t_symbol*pdsym;
+  t_symkeys drivers;
+  t_devcache devices;       /* the devices of the current driver */
+  t_devprobe probe;         /* synchronous enumeration (the buffers are kept for the next time) */
+  t_devprobe diskprobe;     /* re-checks the devices restored from the disk cache */
+  t_as_deferred deferred;
+  t_paramschema params;
+  t_timing timings[TIMING_COUNT];
+} t_as_instance;
+static t_msinstance*as_instances=0;
+static void as_instance_init(t_msinstance*inst);
+static void as_instance_free(t_msinstance*inst);
+static t_as_instance*as_instance(void) {
+  return (t_as_instance*)msinstance_get(&as_instances, sizeof(t_as_instance), as_instance_init);
 }
 
-t_as_drivers*as_finddriverid(t_as_drivers*drivers, const int id) {
-  while(drivers) {
-    if(id==drivers->id)return drivers;
-    drivers=drivers->next;
+static t_symbol*as_getdrivername(const int id) {
+  t_symbol*s=symkeys_getname(&as_instance()->drivers, id);
+  if(s) {
+    return s;
+  } else {
+    return gensym("<unknown>");
   }
-  return NULL;
 }
 
-t_as_drivers*as_adddriver(t_as_drivers*drivers, t_symbol*name, int id, int overwrite) {
-  t_as_drivers*driver=as_finddriver(drivers, name);
+static int as_getdriverid(const t_symbol*id) {
+  return symkeys_getid(&as_instance()->drivers, id);
+}
 
-  if(driver) {
-    if(overwrite) {
-      driver->name=name;
-      driver->id  =id;
-    }
-    return drivers;
-  }
+/* runs in the worker thread for async probes */
+static void as_probe(t_devprobe*probe) {
+  double start=timing_now();
+  as_get_audio_devs(probe->indevlist, &probe->nindevs,
+      probe->outdevlist, &probe->noutdevs,
+      &probe->canmulti, &probe->cancallback,
+      probe->maxndev, probe->devdescsize, probe->api);
+  timing_stop(((t_as_instance*)probe->instance)->timings+TIMING_GET_DEVS, start);
+}
 
-  driver=(t_as_drivers*)getbytes(sizeof(t_as_drivers));
-  driver->name=name;
-  driver->id=id;
-  driver->next=drivers;
+/* sys_close_audio()/sys_reopen_audio() with timing */
+static void as_close_audio(void) {
+  double start=timing_now();
+  sys_close_audio();
+  timing_stop(as_instance()->timings+TIMING_CLOSE, start);
+}
+static void as_reopen_audio(void) {
+  double start=timing_now();
+  sys_reopen_audio();
+  timing_stop(as_instance()->timings+TIMING_REOPEN, start);
+}
 
-  return driver;
+/* the devices of driver <api> */
+/* the disk cache (if enabled) is updated after each enumeration */
+static void as_diskcache_save(const t_as_instance*inst) {
+  diskcache_write("audiosettings", &inst->drivers, &inst->devices);
 }
 
-t_as_drivers*as_driverparse(t_as_drivers*drivers, const char*buf) {
-  int start=-1;
-  int stop =-1;
+static const t_devcache*as_getdevices_api(const int api) {
+  t_as_instance*inst=as_instance();
+  t_devprobe*probe=&inst->probe;
 
-  unsigned int index=0;
-  int depth=0;
-  const char*s;
-  char substring[MAXPDSTRING];
+  if(devcache_isvalid(&inst->devices, api))
+    return &inst->devices;
 
-  for(index=0, s=buf; 0!=*s; s++, index++) {
-    if('{'==*s) {
-      start=index;
-      depth++;
-    }
-    if('}'==*s) {
-      depth--;
-      stop=index;
-
-      if(start>=0 && start<stop) {
-        char drivername[MAXPDSTRING];
-        int  driverid;
-        int length=stop-start;
-        if(length>=MAXPDSTRING)length=MAXPDSTRING-1;
-        snprintf(substring, length, "%s", buf+start+1);
-        if(common_parsedriver(substring, length,
-                drivername, MAXPDSTRING,
-                &driverid)) {
-          drivers=as_adddriver(drivers, gensym(drivername), driverid, 0);
-        } else {
-          if((start+1)!=(stop))
-            post("unparseable: '%s' (%d-%d)", substring, start, stop);
-        }
-      }
-      start=-1;
-      stop=-1;
-    }
-  }
+  if(!probe->probefn)
+    devprobe_init(probe, &inst->i_instance, 0, as_probe, 0);
+  probe->api=api;
+  probe->generation=inst->devices.generation;
+  devprobe_run(probe);
+  devcache_setprobe(&inst->devices, probe, 0);
+  as_diskcache_save(inst);
 
-  return drivers;
+  return &inst->devices;
 }
-
-static t_as_drivers*DRIVERS=NULL;
-
-static t_symbol*as_getdrivername(const int id) {
-  t_as_drivers*driver=as_finddriverid(DRIVERS, id);
-  if(driver) {
-    return driver->name;
-  } else {
-    return gensym("<unknown>");
-  }
+static const t_devcache*as_getdevices(void) {
+  return as_getdevices_api(as_get_audio_api());
 }
 
-static int as_getdriverid(const t_symbol*id) {
-  t_as_drivers*driver=as_finddriver(DRIVERS, id);
-  if(driver) {
-    return driver->id;
+/* restore the drivers and devices from the disk cache,
+ * and re-check the devices in the background
+ * returns 0 if the drivers still have to be queried
+ */
+static void as_diskcache_done(void*owner, t_devprobe*probe) {
+  t_as_instance*inst=(t_as_instance*)probe->instance;
+  (void)owner;
+  devcache_setprobe(&inst->devices, probe, 0);
+  as_diskcache_save(inst);
+}
+static int as_diskcache_load(t_as_instance*inst) {
+  int api=as_get_audio_api();
+  int result=diskcache_read("audiosettings", &inst->drivers, &inst->devices, api);
+  if(result>1) {
+    devprobe_init(&inst->diskprobe, &inst->i_instance, 0, as_probe, as_diskcache_done);
+    devprobe_start(&inst->diskprobe, &inst->devices, api);
   }
-  return -1; /* unknown */
+  return result;
 }
 
 
@@ -270,125 +305,312 @@ static void as_params_print(t_audiosettings*parms) {
   post("rate=%d", parms->a_srate);
   post("advance=%d", parms->a_advance);
   post("callback=%d", parms->a_callback);
+  post("blocksize=%d", parms->a_blocksize);
   post(">=================================\n");
 
 }
 
+/* whether applying <a> would result in the same setup as <b> */
+static int as_params_equal(const t_audiosettings*a, const t_audiosettings*b) {
+  int i;
+  if(a->a_api     !=b->a_api      ||
+     a->a_srate   !=b->a_srate    ||
+     a->a_advance !=b->a_advance  ||
+     a->a_callback!=b->a_callback ||
+     a->a_blocksize!=b->a_blocksize ||
+     a->a_nindev  !=b->a_nindev   ||
+     a->a_noutdev !=b->a_noutdev)
+    return 0;
+  for(i=0; i<a->a_nindev; i++) {
+    if(a->a_indevvec[i]!=b->a_indevvec[i] || a->a_chindevvec[i]!=b->a_chindevvec[i])
+      return 0;
+  }
+  for(i=0; i<a->a_noutdev; i++) {
+    if(a->a_outdevvec[i]!=b->a_outdevvec[i] || a->a_choutdevvec[i]!=b->a_choutdevvec[i])
+      return 0;
+  }
+  return 1;
+}
+
+
+
+/* audio I/O error telemetry
+ * Pd logs its audio I/O errors (ERR_ADCSLEPT...ERR_DATALATE) internally, but has no API
+ * to read them back, so we only count what can be measured from the outside:
+ * - 'late': the scheduler fell behind real time by more than the advance (a dropout)
+ * - 'stuck': Pd closed the device because audio I/O got stuck
+ * the other types are reported as unsupported
+ */
+typedef enum {
+  IOERR_LATE,
+  IOERR_STUCK,
+  IOERR_COUNT
+} t_as_ioerror;
+static const char*as_ioerror_names[] = {"late", "stuck"};
+static const char*as_ioerror_unsupported[] = {"adcsleep", "dacsleep", "resync"};
+
+#define AS_STATS_SLACK 20 /* msec of scheduling jitter (on top of the advance) that isn't 'late' */
+
+typedef struct _as_stats {
+  t_clock*clock;
+  t_float interval;  /* msec (0=off) */
+  double lastpoll;   /* logical time */
+  double lastreal;   /* real time of the last poll (msec) */
+  double lag;        /* how much further the scheduler is behind real time than at the last error */
+  double window;     /* msec since the last poll */
+  int wasopen;
+  unsigned long count[IOERR_COUNT];  /* in the current interval */
+  unsigned long total[IOERR_COUNT];
+} t_as_stats;
+
+/* '@advance auto' */
+#define AS_ADVANCE_AUTO -1
+#define AS_AUTOADVANCE_WINDOW 5000 /* msec without errors before stepping down */
+#define AS_AUTOADVANCE_MAX 500
+#define AS_AUTOADVANCE_STEP(advance) ((advance)>8?(advance)/4:1)
+#define AS_AUTOADVANCE_HYSTERESIS 3  /* clean windows before stepping down again after errors */
+#define AS_AUTOADVANCE_MAXPATIENCE 64
+typedef struct _as_autoadvance {
+  t_clock*clock;
+  int advance;   /* currently used */
+  int lastgood;  /* last advance that ran clean (0=none yet) */
+  int clean;     /* consecutive clean windows with the current advance */
+  int patience;  /* clean windows needed before stepping down */
+  t_float window;
+  t_as_stats stats;
+} t_as_autoadvance;
+
+/* 'prefer': candidates that are tried in order until one opens */
+#define AS_PREFER_TIMEOUT 1000 /* msec */
+typedef struct _as_prefer {
+  t_clock*clock;
+  t_atom*argv;     /* copy of the candidate list */
+  int argc;
+  int pos;         /* start of the candidate being tried */
+  int index;       /* number of the candidate being tried */
+  t_float timeout; /* msec a candidate gets to come up */
+} t_as_prefer;
 
 typedef struct _mediasettings_audiosettings
 {
   t_object x_obj;
   t_outlet*x_info;
 
+  t_devprobe x_probe;
+  t_hotplug x_hotplug;
 
   t_audiosettings x_params;
+
+  t_audiosettings x_stage; /* accumulated by 'stage', applied by 'commit' */
+  int x_staged;
+  unsigned int x_stagechanged;
+
+  int x_defer; /* apply changes via the (per-instance) t_as_deferred */
+  int x_compact; /* output lists as single messages */
+
+  t_as_stats x_stats;
+  t_as_autoadvance x_autoadvance;
+
+  t_canvas*x_canvas; /* profiles are relative to the patch */
+
+  t_as_prefer x_prefer;
+
+  t_watchdog x_watchdog;
+  t_audiosettings x_wdparams; /* the last working setup */
+  t_symbol*x_wdindevs[MAXAUDIOINDEV], *x_wdoutdevs[MAXAUDIOOUTDEV]; /* ...and its devices by name */
+  t_as_stats x_wdstats; /* I/O errors while the device is (still) open */
+  int x_wdstalls;       /* consecutive checks with I/O errors */
 } t_mediasettings_audiosettings;
 
 
 static void audiosettings_listparams(t_mediasettings_audiosettings *x);
-static void audiosettings_listdevices(t_mediasettings_audiosettings *x)
+/* '<selector> <name> <value>' */
+static void audiosettings_output_value(t_mediasettings_audiosettings *x, t_symbol*selector, const char*name, t_atom*value)
 {
-  int i;
-
-  char indevlist[MAXNDEV][DEVDESCSIZE], outdevlist[MAXNDEV][DEVDESCSIZE];
-  int indevs = 0, outdevs = 0, canmulti = 0, cancallback = 0;
+  t_atom atoms[2];
+  SETSYMBOL(atoms+0, gensym(name));
+  atoms[1]=*value;
+  outlet_anything(x->x_info, selector, 2, atoms);
+}
+static void audiosettings_output_float(t_mediasettings_audiosettings *x, t_symbol*selector, const char*name, int value)
+{
+  t_atom a;
+  SETFLOAT(&a, (t_float)value);
+  audiosettings_output_value(x, selector, name, &a);
+}
 
+/* 'device <dir> devices <num>' + 'device <dir> <index> <name>' (for each device)
+ * in compact mode: 'device <dir> <name0> <name1>...'
+ */
+static void audiosettings_listdevices_dir(t_mediasettings_audiosettings *x, const char*dir, const t_symkeys*devs)
+{
+  unsigned int i;
+  t_symbol*s_device=gensym("device");
   t_atom atoms[3];
-  int api = 0;
-  as_get_audio_devs((char*)indevlist, &indevs,
-      (char*)outdevlist, &outdevs,
-      &canmulti, &cancallback,
-      MAXNDEV, DEVDESCSIZE, &api);
-
-  SETSYMBOL (atoms+0, gensym("driver"));
-  SETSYMBOL (atoms+1, as_getdrivername(api));
-  outlet_anything(x->x_info, gensym("device"), 2, atoms);
-
-  SETSYMBOL (atoms+0, gensym("multi"));
-  SETFLOAT (atoms+1, (t_float)canmulti);
-  outlet_anything(x->x_info, gensym("device"), 2, atoms);
 
-  SETSYMBOL (atoms+0, gensym("callback"));
-  SETFLOAT (atoms+1, (t_float)cancallback);
-  outlet_anything(x->x_info, gensym("device"), 2, atoms);
+  if(x->x_compact) {
+    t_atom*ap=(t_atom*)getbytes((devs->count+1)*sizeof(*ap));
+    SETSYMBOL(ap+0, gensym(dir));
+    for(i=0; i<devs->count; i++)
+      SETSYMBOL(ap+i+1, devs->entries[i].name);
+    outlet_anything(x->x_info, s_device, devs->count+1, ap);
+    freebytes(ap, (devs->count+1)*sizeof(*ap));
+    return;
+  }
 
-  SETSYMBOL(atoms+0, gensym("in"));
+  SETSYMBOL(atoms+0, gensym(dir));
 
   SETSYMBOL(atoms+1, gensym("devices"));
-  SETFLOAT (atoms+2, (t_float)indevs);
-  outlet_anything(x->x_info, gensym("device"), 3, atoms);
+  SETFLOAT (atoms+2, (t_float)devs->count);
+  outlet_anything(x->x_info, s_device, 3, atoms);
 
-  for(i=0; i<indevs; i++) {
+  for(i=0; i<devs->count; i++) {
     SETFLOAT (atoms+1, (t_float)i);
-    SETSYMBOL(atoms+2, gensym(indevlist[i]));
-    outlet_anything(x->x_info, gensym("device"), 3, atoms);
+    SETSYMBOL(atoms+2, devs->entries[i].name);
+    outlet_anything(x->x_info, s_device, 3, atoms);
   }
+}
 
-  SETSYMBOL(atoms+0, gensym("out"));
+static void audiosettings_listdevices_output(t_mediasettings_audiosettings *x, const t_devcache*devices)
+{
+  t_symbol*s_device=gensym("device");
+  t_atom a;
 
-  SETSYMBOL(atoms+1, gensym("devices"));
-  SETFLOAT (atoms+2, (t_float)outdevs);
-  outlet_anything(x->x_info, gensym("device"), 3, atoms);
+  SETSYMBOL(&a, as_getdrivername(devices->api));
+  audiosettings_output_value(x, s_device, "driver", &a);
+  audiosettings_output_float(x, s_device, "multi", devices->canmulti);
+  audiosettings_output_float(x, s_device, "callback", devices->cancallback);
 
-  for(i=0; i<outdevs; i++) {
-    SETFLOAT (atoms+1, (t_float)i);
-    SETSYMBOL(atoms+2, gensym(outdevlist[i]));
-    outlet_anything(x->x_info, gensym("device"), 3, atoms);
+  audiosettings_listdevices_dir(x, "in" , &devices->indevs);
+  audiosettings_listdevices_dir(x, "out", &devices->outdevs);
+}
+static void audiosettings_listdevices_finish(t_mediasettings_audiosettings *x) {
+  t_atom ap[1];
+  SETSYMBOL(ap+0, gensym("listdevices"));
+  outlet_anything(x->x_info, gensym("done"), 1, ap);
+}
+
+/* called with the Pd-lock held, once the worker thread has finished probing */
+static void audiosettings_listdevices_done(void*owner, t_devprobe*probe) {
+  t_mediasettings_audiosettings *x=(t_mediasettings_audiosettings *)owner;
+  t_as_instance*inst=(t_as_instance*)probe->instance;
+  devcache_setprobe(&inst->devices, probe, 0);
+  as_diskcache_save(inst);
+  audiosettings_listdevices_output(x, &inst->devices);
+  audiosettings_listdevices_finish(x);
+}
+
+/* 'listdevices' outputs the devices right away,
+ * 'listdevices async' probes the devices in a worker thread (if needed),
+ * and outputs them later (followed by 'done listdevices')
+ */
+static void audiosettings_listdevices(t_mediasettings_audiosettings *x, t_symbol*s, int argc, t_atom*argv)
+{
+  int async=0;
+  (void)s;
+  if(argc && A_SYMBOL==argv->a_type && gensym("async")==atom_getsymbol(argv))
+    async=1;
+  else if (argc) {
+    pd_error(x, "usage: listdevices [async]");
+    return;
   }
+
+  if(async) {
+    t_as_instance*inst=as_instance();
+    int api=as_get_audio_api();
+    if(!devcache_isvalid(&inst->devices, api)) {
+      if(devprobe_start(&x->x_probe, &inst->devices, api)<0) {
+        pd_error(x, "unable to start device probe");
+      }
+      return;
+    }
+    audiosettings_listdevices_output(x, &inst->devices);
+    audiosettings_listdevices_finish(x);
+    return;
+  }
+  audiosettings_listdevices_output(x, as_getdevices());
 }
 
 /* this is the actual settings used
  *
  */
-static void audiosettings_listparams(t_mediasettings_audiosettings *x) {
+/* 'params <dir> devices <num>' + 'params <dir> <device> <channels>' (for each device)
+ * in compact mode: 'params <dir> <device0> <channels0> <device1> <channels1>...'
+ */
+static void audiosettings_listparams_dir(t_mediasettings_audiosettings *x, const char*dir,
+                                         int ndevs, const int*devs, const int*chans) {
   int i;
-  t_atom atoms[4];
-
-  t_audiosettings params;
-  sys_get_audio_settings(&params);
-
-  SETSYMBOL (atoms+0, gensym("rate"));
-  SETFLOAT (atoms+1, (t_float)params.a_srate);
-  outlet_anything(x->x_info, gensym("params"), 2, atoms);
-
-  SETSYMBOL (atoms+0, gensym("advance"));
-  SETFLOAT (atoms+1, (t_float)params.a_advance);
-  outlet_anything(x->x_info, gensym("params"), 2, atoms);
+  t_symbol*s_params=gensym("params");
+  t_atom atoms[3];
 
-  SETSYMBOL (atoms+0, gensym("callback"));
-  SETFLOAT (atoms+1, (t_float)params.a_callback);
-  outlet_anything(x->x_info, gensym("params"), 2, atoms);
+  if(x->x_compact) {
+    t_atom*ap=(t_atom*)getbytes((2*ndevs+1)*sizeof(*ap));
+    SETSYMBOL(ap+0, gensym(dir));
+    for(i=0; i<ndevs; i++) {
+      SETFLOAT(ap+2*i+1, (t_float)devs[i]);
+      SETFLOAT(ap+2*i+2, (t_float)chans[i]);
+    }
+    outlet_anything(x->x_info, s_params, 2*ndevs+1, ap);
+    freebytes(ap, (2*ndevs+1)*sizeof(*ap));
+    return;
+  }
 
-  SETSYMBOL(atoms+0, gensym("in"));
+  SETSYMBOL(atoms+0, gensym(dir));
 
   SETSYMBOL(atoms+1, gensym("devices"));
-  SETFLOAT (atoms+2, (t_float)params.a_nindev);
-  outlet_anything(x->x_info, gensym("params"), 3, atoms);
+  SETFLOAT (atoms+2, (t_float)ndevs);
+  outlet_anything(x->x_info, s_params, 3, atoms);
 
-  for(i=0; i<params.a_nindev; i++) {
-    SETFLOAT (atoms+1, (t_float)params.a_indevvec[i]);
-    SETFLOAT (atoms+2, (t_float)params.a_chindevvec[i]);
-    outlet_anything(x->x_info, gensym("params"), 3, atoms);
+  for(i=0; i<ndevs; i++) {
+    SETFLOAT (atoms+1, (t_float)devs[i]);
+    SETFLOAT (atoms+2, (t_float)chans[i]);
+    outlet_anything(x->x_info, s_params, 3, atoms);
   }
+}
 
-  SETSYMBOL(atoms+0, gensym("out"));
+static void audiosettings_listparams(t_mediasettings_audiosettings *x) {
+  t_symbol*s_params=gensym("params");
+  t_audiosettings params;
+  sys_get_audio_settings(&params);
 
-  SETSYMBOL(atoms+1, gensym("devices"));
-  SETFLOAT (atoms+2, (t_float)params.a_noutdev);
-  outlet_anything(x->x_info, gensym("params"), 3, atoms);
+  audiosettings_output_float(x, s_params, "rate", params.a_srate);
+  audiosettings_output_float(x, s_params, "advance", params.a_advance);
+  audiosettings_output_float(x, s_params, "callback", params.a_callback);
+  audiosettings_output_float(x, s_params, "blocksize", params.a_blocksize);
 
-  for(i=0; i<params.a_noutdev; i++) {
-    SETFLOAT (atoms+1, (t_float)params.a_outdevvec[i]);
-    SETFLOAT (atoms+2, (t_float)params.a_choutdevvec[i]);
-    outlet_anything(x->x_info, gensym("params"), 3, atoms);
-  }
+  audiosettings_listparams_dir(x, "in" , params.a_nindev , params.a_indevvec , params.a_chindevvec );
+  audiosettings_listparams_dir(x, "out", params.a_noutdev, params.a_outdevvec, params.a_choutdevvec);
 }
 
 
-static void audiosettings_params_init(t_mediasettings_audiosettings*x) {
-  sys_get_audio_settings(&x->x_params);
+static void audiosettings_params_init(t_mediasettings_audiosettings*x, t_audiosettings*params) {
+  (void)x;
+  sys_get_audio_settings(params);
+}
+/* Pd's 'audio-dialog' has a fixed number of device slots (per direction),
+ * regardless of MAXAUDIOINDEV/MAXAUDIOOUTDEV */
+#define AS_DIALOG_NDEV 4
+
+/* hand the settings to Pd directly (rather than via the GUI's 'audio-dialog'),
+ * so all fields of t_audiosettings are used as they are
+ * returns 0 if this is not possible with this version of Pd
+ */
+static int audiosettings_params_apply_direct(t_mediasettings_audiosettings*x, const t_audiosettings*params) {
+#if AUDIOSETTINGS_API == 1
+  t_audiosettings as=*params;
+  (void)x;
+  as_close_audio();
+  sys_set_audio_settings(&as);
+  as_reopen_audio();
+  return 1;
+#else
+  (void)x;
+  (void)params;
+  return 0;
+#endif
 }
-static void audiosettings_params_apply(t_mediasettings_audiosettings*x) {
+
+static void audiosettings_params_apply(t_mediasettings_audiosettings*x, const t_audiosettings*params) {
   /*
     "pd audio-dialog ..."
     #00: indev[0]
@@ -410,215 +632,473 @@ static void audiosettings_params_apply(t_mediasettings_audiosettings*x) {
     #16: rate
     #17: advance
     #18: callback
+    #19: blocksize
   */
 
-  t_atom argv [2*MAXAUDIOINDEV+2*MAXAUDIOOUTDEV+3];
-  int argc=2*MAXAUDIOINDEV+2*MAXAUDIOOUTDEV+3;
+  t_as_instance*inst=as_instance();
+  t_atom argv [4*AS_DIALOG_NDEV+4];
+  int argc=4*AS_DIALOG_NDEV+4;
 
   int i=0;
+  t_audiosettings current;
 
-  //  as_params_print(&x->x_params);
+  //  as_params_print(params);
 
-  for(i=0; i<MAXAUDIOINDEV; i++) {
-    SETFLOAT(argv+i+0*MAXAUDIOINDEV, (t_float)(x->x_params.a_indevvec[i]));
-    SETFLOAT(argv+i+1*MAXAUDIOINDEV, (t_float)(x->x_params.a_chindevvec   [i]));
+  /* don't re-open the audio device if nothing changes
+   * (unless it has failed or been closed: then re-opening is the point) */
+  sys_get_audio_settings(&current);
+  if(as_params_equal(params, &current) && audio_isopen()) {
+    verbose(1, "audio settings unchanged: not re-opening");
+    return;
   }
-  for(i=0; i<MAXAUDIOOUTDEV; i++) {
-    SETFLOAT(argv+i+2*MAXAUDIOINDEV+0*MAXAUDIOOUTDEV,(t_float)(x->x_params.a_outdevvec[i]));
-    SETFLOAT(argv+i+2*MAXAUDIOINDEV+1*MAXAUDIOOUTDEV,(t_float)(x->x_params.a_choutdevvec   [i]));
+
+  devcache_invalidate(&inst->devices);
+  inst->deferred.lastapply=clock_getlogicaltime();
+
+  if(audiosettings_params_apply_direct(x, params))
+    return;
+
+  /* fallback: the 'audio-dialog' message */
+  if(params->a_nindev>AS_DIALOG_NDEV || params->a_noutdev>AS_DIALOG_NDEV)
+    pd_error(x, "this version of Pd only allows setting %d devices per direction", AS_DIALOG_NDEV);
+
+  /* unused slots have 0 channels */
+  for(i=0; i<AS_DIALOG_NDEV; i++) {
+    int used=(i<params->a_nindev);
+    SETFLOAT(argv+i+0*AS_DIALOG_NDEV, (t_float)(used?params->a_indevvec[i]:0));
+    SETFLOAT(argv+i+1*AS_DIALOG_NDEV, (t_float)(used?params->a_chindevvec   [i]:0));
+  }
+  for(i=0; i<AS_DIALOG_NDEV; i++) {
+    int used=(i<params->a_noutdev);
+    SETFLOAT(argv+i+2*AS_DIALOG_NDEV,(t_float)(used?params->a_outdevvec[i]:0));
+    SETFLOAT(argv+i+3*AS_DIALOG_NDEV,(t_float)(used?params->a_choutdevvec   [i]:0));
   }
 
-  SETFLOAT(argv+2*MAXAUDIOINDEV+2*MAXAUDIOOUTDEV+0,(t_float)(x->x_params.a_srate));
-  SETFLOAT(argv+2*MAXAUDIOINDEV+2*MAXAUDIOOUTDEV+1,(t_float)(x->x_params.a_advance));
-  SETFLOAT(argv+2*MAXAUDIOINDEV+2*MAXAUDIOOUTDEV+2,(t_float)(x->x_params.a_callback));
+  SETFLOAT(argv+4*AS_DIALOG_NDEV+0,(t_float)(params->a_srate));
+  SETFLOAT(argv+4*AS_DIALOG_NDEV+1,(t_float)(params->a_advance));
+  SETFLOAT(argv+4*AS_DIALOG_NDEV+2,(t_float)(params->a_callback));
+  SETFLOAT(argv+4*AS_DIALOG_NDEV+3,(t_float)(params->a_blocksize));
 
-  if (s_pdsym->s_thing) typedmess(s_pdsym->s_thing,
+  if (inst->pdsym->s_thing) {
+    double start=timing_now();
+    typedmess(inst->pdsym->s_thing,
       gensym("audio-dialog"),
       argc,
       argv);
+    timing_stop(as_instance()->timings+TIMING_DIALOG, start);
+  }
 }
 
 
-/* find the beginning of the next parameter in the list */
+/* apply targets of the parameters (bits in the 'changed' mask) */
 typedef enum {
   PARAM_RATE,
   PARAM_ADVANCE,
   PARAM_CALLBACK,
   PARAM_INPUT,
   PARAM_OUTPUT,
-  PARAM_INVALID
-} t_paramtype;
-static t_paramtype audiosettings_setparams_id(t_symbol*s) {
-  if(gensym("@rate")==s) {
-    return PARAM_RATE;
-  } else if(gensym("@samplerate")==s) {
-    return PARAM_RATE;
-  } else if(gensym("@advance")==s) {
-    return PARAM_ADVANCE;
-  } else if(gensym("@buffersize")==s) {
-    return PARAM_ADVANCE;
-  } else if(gensym("@callback")==s) {
-    return PARAM_CALLBACK;
-  } else if(gensym("@input")==s) {
-    return PARAM_INPUT;
-  } else if(gensym("@output")==s) {
-    return PARAM_OUTPUT;
-  }
-  return PARAM_INVALID;
-}
-
-/* find the beginning of the next parameter in the list */
-static int audiosettings_setparams_next(int argc, t_atom*argv) {
-  int i=0;
-  for(i=0; i<argc; i++) {
-    if(A_SYMBOL==argv[i].a_type) {
-      t_symbol*s=atom_getsymbol(argv+i);
-      if('@'==s->s_name[0])
-        return i;
-    }
-  }
-  return i;
-}
+  PARAM_BLOCKSIZE,
+  PARAM_COUNT
+} t_as_param;
 
-/* <rate> ... */
-static int audiosettings_setparams_rate(t_mediasettings_audiosettings*x, int argc, t_atom*argv) {
-  if(argc<=0)return 1;
-  t_int rate=atom_getint(argv);
-  if(rate>0)
-    x->x_params.a_srate=rate;
-  return 1;
+/* whether the audio I/O is running (rather than just open) */
+static int as_stats_running(int isopen) {
+#if AUDIOSETTINGS_API == 1
+  return isopen && pd_getdspstate();
+#else
+  return isopen;
+#endif
 }
+/* count the errors since the last poll into stats->count
+ * returns the total number of errors */
+static unsigned long as_stats_poll(t_as_stats*stats) {
+  int isopen=audio_isopen();
+  double now=sys_getrealtime()*1000.;
+  unsigned long errors=0;
+  int i;
 
-/* <advance> ... */
-static int audiosettings_setparams_advance(t_mediasettings_audiosettings*x, int argc, t_atom*argv) {
-  if(argc<=0)return 1;
-  t_int advance=atom_getint(argv);
-  if(advance>0)
-    x->x_params.a_advance=advance;
+  stats->window=clock_gettimesince(stats->lastpoll);
+  memset(stats->count, 0, sizeof(stats->count));
 
-  return 1;
-}
+  /* while audio is running, logical time follows real time (within the advance);
+   * if it falls further behind, the audio I/O has missed its deadline */
+  stats->lag+=(now-stats->lastreal)-stats->window;
+  if(stats->lag<0 || !stats->wasopen || !as_stats_running(isopen)) {
+    stats->lag=0; /* caught up (or not running at all) */
+  } else {
+    t_audiosettings params;
+    sys_get_audio_settings(&params);
+    if(stats->lag > params.a_advance+AS_STATS_SLACK) {
+      stats->count[IOERR_LATE]++;
+      stats->lag=0; /* only count it again if it gets even later */
+    }
+  }
 
-/* <callback?> ... */
-static int audiosettings_setparams_callback(t_mediasettings_audiosettings*x, int argc, t_atom*argv) {
-  if(argc<=0)return 1;
-  t_int callback=atom_getint(argv);
-  x->x_params.a_callback=callback;
+#if AUDIOSETTINGS_API == 1
+  /* Pd closes the device (but keeps DSP running) if audio I/O gets stuck */
+  if(stats->wasopen && !isopen && pd_getdspstate() && as_instance()->deferred.lastapply < stats->lastpoll)
+    stats->count[IOERR_STUCK]++;
+#endif
+  stats->wasopen=isopen;
+  stats->lastpoll=clock_getlogicaltime();
+  stats->lastreal=now;
 
-  return 1;
+  for(i=0; i<IOERR_COUNT; i++)
+    errors+=stats->count[i];
+  return errors;
+}
+/* only count errors from now on */
+static void as_stats_reset(t_as_stats*stats) {
+  stats->lastpoll=clock_getlogicaltime();
+  stats->lastreal=sys_getrealtime()*1000.;
+  stats->lag=0;
+  stats->wasopen=audio_isopen();
 }
 
-/* [<device> <channels>]* ... */
-static int audiosettings_setparams_input(t_mediasettings_audiosettings*x, int argc, t_atom*argv) {
-  int length=audiosettings_setparams_next(argc, argv);
-  int i;
-  int numpairs=length/2;
-
-  if(length%2)return length;
+/* '@advance auto': keep the advance as small as possible without I/O errors
+ * the advance is stepped down as long as the measurement windows stay clean,
+ * and stepped up (back to the last clean value) on errors;
+ * after errors it takes a number of clean windows (doubling with each failure)
+ * before a smaller advance is tried again
+ */
+static void audiosettings_autoadvance_tick(t_mediasettings_audiosettings *x) {
+  t_as_autoadvance*tune=&x->x_autoadvance;
+  unsigned long errors=as_stats_poll(&tune->stats);
+  t_atom atoms[2];
+  int next=tune->advance;
+
+  SETFLOAT(atoms+0, (t_float)tune->advance);
+  SETFLOAT(atoms+1, (t_float)errors);
+  outlet_anything(x->x_info, gensym("autoadvance"), 2, atoms);
+
+  if(errors) {
+    tune->clean=0;
+    if(tune->patience<AS_AUTOADVANCE_HYSTERESIS)
+      tune->patience=AS_AUTOADVANCE_HYSTERESIS;
+    else if(tune->patience<AS_AUTOADVANCE_MAXPATIENCE)
+      tune->patience*=2;
+    if(tune->lastgood>tune->advance)
+      next=tune->lastgood;
+    else
+      next=tune->advance+AS_AUTOADVANCE_STEP(tune->advance);
+    if(next>AS_AUTOADVANCE_MAX)
+      next=AS_AUTOADVANCE_MAX;
+  } else {
+    tune->lastgood=tune->advance;
+    if(++tune->clean>=tune->patience && tune->advance>1)
+      next=tune->advance-AS_AUTOADVANCE_STEP(tune->advance);
+  }
 
-  if(numpairs>MAXAUDIOINDEV)
-    numpairs=MAXAUDIOINDEV;
+  if(next!=tune->advance) {
+    t_audiosettings params;
+    audiosettings_params_init(x, &params);
+    params.a_advance=tune->advance=next;
+    audiosettings_params_apply(x, &params);
+    tune->clean=0;
+  }
 
-  for(i=0; i<numpairs; i++) {
-    int dev=0;
-    int ch=0;
+  as_stats_reset(&tune->stats);
+  clock_delay(tune->clock, tune->window);
+}
+static void audiosettings_autoadvance_start(t_mediasettings_audiosettings *x, int advance) {
+  t_as_autoadvance*tune=&x->x_autoadvance;
+  tune->advance=advance;
+  tune->lastgood=0;
+  tune->clean=0;
+  tune->patience=1;
+  as_stats_reset(&tune->stats);
+  clock_delay(tune->clock, tune->window);
+}
+static void audiosettings_autoadvance_stop(t_mediasettings_audiosettings *x) {
+  clock_unset(x->x_autoadvance.clock);
+}
+/* start resp. stop auto-tuning, depending on the '@advance' of <params> */
+static void audiosettings_autoadvance_check(t_mediasettings_audiosettings *x, t_audiosettings*params, unsigned int changed) {
+  if(!(changed & (1<<PARAM_ADVANCE)))
+    return;
+  if(AS_ADVANCE_AUTO == params->a_advance) {
+    t_audiosettings current;
+    sys_get_audio_settings(&current);
+    params->a_advance=current.a_advance;
+    audiosettings_autoadvance_start(x, current.a_advance);
+  } else {
+    audiosettings_autoadvance_stop(x);
+  }
+}
 
-    if(A_FLOAT==argv[2*i+0].a_type) {
-      dev=atom_getint(argv);
-    } else if (A_SYMBOL==argv[2*i+0].a_type) {
-      // LATER: get the device-id from the device-name
-      continue;
-    } else {
-      continue;
+/* <value> ... (PARAMTYPE_INT, PARAMTYPE_BOOL, PARAMTYPE_POW2) */
+static int paramspec_setint(const void*x, void*params, const t_paramspec*spec, int argc, t_atom*argv) {
+  t_float value;
+  if(argc<=0 || A_FLOAT!=argv->a_type) {
+    pd_error(x, "@%s: expects a number", spec->keyword);
+    return 0;
+  }
+  value=atom_getfloat(argv);
+  if(PARAMTYPE_BOOL==spec->type)
+    value=(value!=0);
+  if(PARAMTYPE_POW2==spec->type) {
+    int ivalue=(int)value;
+    if(ivalue<=0 || ivalue!=value || (ivalue & (ivalue-1))) {
+      pd_error(x, "@%s: %g is not a power of two", spec->keyword, value);
+      return 0;
     }
-    ch=atom_getint(argv+2*i+1);
-
-    x->x_params.a_indevvec[i]=dev;
-    x->x_params.a_chindevvec[i]=ch;
   }
+  if(!paramspec_check(x, spec, value))
+    return 0;
+  *(int*)((char*)params+spec->offset)=(int)value;
+  return 1;
+}
 
-  return length;
+/* the device cache if it is valid already, without enumerating */
+static const t_devcache*as_validdevices(void) {
+  const t_devcache*cache=&as_instance()->devices;
+  return devcache_isvalid(cache, as_get_audio_api())?cache:0;
 }
 
-static int audiosettings_setparams_output(t_mediasettings_audiosettings*x, int argc, t_atom*argv) {
-  int length=audiosettings_setparams_next(argc, argv);
+/* [<device> <channels>]* ...
+ * if any of the devices is invalid, the whole list is rejected
+ * device names are looked up in <cache>; if that is NULL, the devices are only
+ * enumerated if there is a name (numeric ids are checked against an already valid cache,
+ * or else left to Pd when the settings are applied) */
+static int audiosettings_setparams_devpairs(const void*x, const t_paramspec*spec, int argc, t_atom*argv,
+                                            const t_devcache*cache, int output,
+                                            int*devices, int*channels, int*numdevices, int*numchannels) {
+  int length=paramschema_next(argc, argv);
+  const t_devcache*known=cache?cache:as_validdevices();
+  int devs[MAXAUDIODEV], chans[MAXAUDIODEV];
   int i;
   int numpairs=length/2;
 
-  if(length%2)return length;
+  if(length%2) {
+    pd_error(x, "@%s: expects <device> <channels> pairs", spec->keyword);
+    return 0;
+  }
 
-  if(numpairs>MAXAUDIOOUTDEV)
-    numpairs=MAXAUDIOOUTDEV;
+  if(numpairs>(int)spec->maxcount) {
+    pd_error(x, "@%s: only %d devices supported, ignoring the rest", spec->keyword, spec->maxcount);
+    numpairs=spec->maxcount;
+  }
 
   for(i=0; i<numpairs; i++) {
     int dev=0;
-    int ch=0;
 
     if(A_FLOAT==argv[2*i+0].a_type) {
-      dev=atom_getint(argv);
+      dev=atom_getint(argv+2*i+0);
+      if(known && !symkeys_getname(output?&known->outdevs:&known->indevs, dev)) {
+        pd_error(x, "@%s: no device #%d", spec->keyword, dev);
+        return 0;
+      }
     } else if (A_SYMBOL==argv[2*i+0].a_type) {
-      // LATER: get the device-id from the device-name
-      continue;
+      t_symbol*name=atom_getsymbol(argv+2*i+0);
+      if(!cache)
+        known=cache=as_getdevices();
+      if(output)
+        dev=devindex_find(&cache->outindex, &cache->outdevs, name);
+      else
+        dev=devindex_find(&cache->inindex , &cache->indevs , name);
+      if(DEVINDEX_AMBIGUOUS==dev) {
+        pd_error(x, "@%s: device name '%s' is ambiguous", spec->keyword, name->s_name);
+        return 0;
+      } else if(dev<0) {
+        pd_error(x, "@%s: no device matching '%s'", spec->keyword, name->s_name);
+        return 0;
+      }
     } else {
-      continue;
+      pd_error(x, "@%s: expects <device> <channels> pairs", spec->keyword);
+      return 0;
+    }
+    if(!paramspec_check(x, spec, dev))
+      return 0;
+
+    /* the channel counts have the same (lower) limit as the ids */
+    if(A_FLOAT!=argv[2*i+1].a_type) {
+      pd_error(x, "@%s: expects <device> <channels> pairs", spec->keyword);
+      return 0;
     }
-    ch=atom_getint(argv+2*i+1);
+    if(!paramspec_check(x, spec, atom_getfloat(argv+2*i+1)))
+      return 0;
+
+    devs[i]=dev;
+    chans[i]=atom_getint(argv+2*i+1);
+  }
 
-    x->x_params.a_outdevvec[i]=dev;
-    x->x_params.a_choutdevvec[i]=ch;
+  for(i=0; i<numpairs; i++) {
+    devices[i]=devs[i];
+    channels[i]=chans[i];
   }
+  *numdevices=*numchannels=numpairs;
 
-  return length;
+  return 1;
+}
+static int audiosettings_setparams_input(const void*x, void*params_, const t_paramspec*spec, int argc, t_atom*argv) {
+  t_audiosettings*params=(t_audiosettings*)params_;
+  return audiosettings_setparams_devpairs(x, spec, argc, argv, 0, 0,
+                                          params->a_indevvec, params->a_chindevvec,
+                                          &params->a_nindev, &params->a_nchindev);
+}
+static int audiosettings_setparams_output(const void*x, void*params_, const t_paramspec*spec, int argc, t_atom*argv) {
+  t_audiosettings*params=(t_audiosettings*)params_;
+  return audiosettings_setparams_devpairs(x, spec, argc, argv, 0, 1,
+                                          params->a_outdevvec, params->a_choutdevvec,
+                                          &params->a_noutdev, &params->a_nchoutdev);
 }
 
-static void audiosettings_setparams(t_mediasettings_audiosettings *x, t_symbol*s, int argc, t_atom*argv) {
-  /*
-    PLAN:
-    several messages that accumulate to a certain settings, and then "apply" them
-  */
-  int apply=1;
-  int advance=0;
-  t_paramtype param=PARAM_INVALID;
+/* <advance> | auto */
+static int audiosettings_setparams_advance(const void*x, void*params, const t_paramspec*spec, int argc, t_atom*argv) {
+  if(argc>0 && A_SYMBOL==argv->a_type && gensym("auto")==atom_getsymbol(argv)) {
+    ((t_audiosettings*)params)->a_advance=AS_ADVANCE_AUTO;
+    return 1;
+  }
+  return paramspec_setint(x, params, spec, argc, argv);
+}
 
-  audiosettings_params_init (x); /* re-initialize to what we got */
+static const t_paramspec as_paramspecs[] = {
+  /* keyword    aliases            target          type             min  max  maxcount        offset/setfn */
+  [PARAM_RATE]=
+  {"rate",     {"samplerate", 0}, PARAM_RATE,     PARAMTYPE_INT,      1,  0, 1,
+   offsetof(t_audiosettings, a_srate),    paramspec_setint},
+  [PARAM_ADVANCE]=
+  {"advance",  {"buffersize", 0}, PARAM_ADVANCE,  PARAMTYPE_INT,      1,  0, 1,
+   offsetof(t_audiosettings, a_advance),  audiosettings_setparams_advance},
+  [PARAM_CALLBACK]=
+  {"callback", {0},               PARAM_CALLBACK, PARAMTYPE_BOOL,     0,  1, 1,
+   offsetof(t_audiosettings, a_callback), paramspec_setint},
+  [PARAM_INPUT]=
+  {"input",    {0},               PARAM_INPUT,    PARAMTYPE_DEVPAIRS, 0, -1, MAXAUDIOINDEV,
+   0, audiosettings_setparams_input},
+  [PARAM_OUTPUT]=
+  {"output",   {0},               PARAM_OUTPUT,   PARAMTYPE_DEVPAIRS, 0, -1, MAXAUDIOOUTDEV,
+   0, audiosettings_setparams_output},
+  [PARAM_BLOCKSIZE]=
+  {"blocksize", {0},              PARAM_BLOCKSIZE, PARAMTYPE_POW2, DEFDACBLKSIZE, 2048, 1,
+   offsetof(t_audiosettings, a_blocksize), paramspec_setint},
+};
+PARAMSCHEMA_CHECKSIZE(as_paramspecs, PARAM_COUNT);
+
+/* parse '@<param> <values>...' into <params>
+ * returns the parameters that were touched (as 1<<t_as_param) */
+static unsigned int audiosettings_setparams_parse(t_mediasettings_audiosettings *x, t_audiosettings*params, int argc, t_atom*argv) {
+  return paramschema_parse(&as_instance()->params, x, params, argc, argv);
+}
 
-  advance=audiosettings_setparams_next(argc, argv);
-  while((argc-=advance)>0) {
-    argv+=advance;
-    s=atom_getsymbol(argv);
-    param=audiosettings_setparams_id(s);
+/* copy the <changed> parameters from <src> to <dst> */
+static void as_params_merge(t_audiosettings*dst, const t_audiosettings*src, unsigned int changed) {
+  int i;
+  if(changed & (1<<PARAM_RATE))
+    dst->a_srate=src->a_srate;
+  if(changed & (1<<PARAM_ADVANCE))
+    dst->a_advance=src->a_advance;
+  if(changed & (1<<PARAM_CALLBACK))
+    dst->a_callback=src->a_callback;
+  if(changed & (1<<PARAM_BLOCKSIZE))
+    dst->a_blocksize=src->a_blocksize;
+  if(changed & (1<<PARAM_INPUT)) {
+    dst->a_nindev=src->a_nindev;
+    dst->a_nchindev=src->a_nchindev;
+    for(i=0; i<MAXAUDIOINDEV; i++) {
+      dst->a_indevvec[i]=src->a_indevvec[i];
+      dst->a_chindevvec[i]=src->a_chindevvec[i];
+    }
+  }
+  if(changed & (1<<PARAM_OUTPUT)) {
+    dst->a_noutdev=src->a_noutdev;
+    dst->a_nchoutdev=src->a_nchoutdev;
+    for(i=0; i<MAXAUDIOOUTDEV; i++) {
+      dst->a_outdevvec[i]=src->a_outdevvec[i];
+      dst->a_choutdevvec[i]=src->a_choutdevvec[i];
+    }
+  }
+}
 
-    argv++;
-    argc--;
+/* the changes of all deferring objects are merged and applied with a single re-open
+ * (at the end of the current logical time, but no sooner than <mininterval> msecs
+ * after the last re-open)
+ */
+static void audiosettings_deferred_tick(t_as_deferred*deferred) {
+  t_audiosettings params;
+  double since=clock_gettimesince(deferred->lastapply);
 
-    switch(param) {
-    case PARAM_RATE:
-      advance=audiosettings_setparams_rate(x, argc, argv);
-      break;
-    case PARAM_ADVANCE:
-      advance=audiosettings_setparams_advance(x, argc, argv);
-      break;
-    case PARAM_CALLBACK:
-      advance=audiosettings_setparams_callback(x, argc, argv);
-      break;
-    case PARAM_INPUT:
-      advance=audiosettings_setparams_input(x, argc, argv);
-      break;
-    case PARAM_OUTPUT:
-      advance=audiosettings_setparams_output(x, argc, argv);
-      break;
-    default:
-      pd_error(x, "unknown parameter"); postatom(1, argv);endpost();
-      break;
-    }
+  deferred->scheduled=0;
+  if(!deferred->changed)
+    return;
+  if(since < deferred->mininterval) {
+    clock_delay(deferred->clock, deferred->mininterval - since);
+    deferred->scheduled=1;
+    return;
+  }
+
+  sys_get_audio_settings(&params);
+  as_params_merge(&params, &deferred->params, deferred->changed);
+  deferred->changed=0;
+  audiosettings_params_apply(0, &params);
+}
+static void audiosettings_defer(const t_audiosettings*params, unsigned int changed) {
+  t_as_deferred*deferred=&as_instance()->deferred;
+  if(!changed)
+    return;
+  if(!deferred->clock)
+    deferred->clock=clock_new(deferred, (t_method)audiosettings_deferred_tick);
+  as_params_merge(&deferred->params, params, changed);
+  deferred->changed|=changed;
+  if(!deferred->scheduled) {
+    clock_delay(deferred->clock, 0);
+    deferred->scheduled=1;
+  }
+}
 
-    argc-=advance;
-    argv+=advance;
-    advance=audiosettings_setparams_next(argc, argv);
+static void audiosettings_setparams(t_mediasettings_audiosettings *x, t_symbol*s, int argc, t_atom*argv) {
+  unsigned int changed;
+  (void)s;
+  audiosettings_params_init (x, &x->x_params); /* re-initialize to what we got */
+  changed=audiosettings_setparams_parse(x, &x->x_params, argc, argv);
+  audiosettings_autoadvance_check(x, &x->x_params, changed);
+  if(x->x_defer)
+    audiosettings_defer(&x->x_params, changed);
+  else
+    audiosettings_params_apply(x, &x->x_params);
+}
+
+/* several messages that accumulate to a certain setting, which is then applied at once:
+ * 'stage @<param> <values>...' (repeatedly), followed by 'commit' (or 'discard')
+ */
+static void audiosettings_stage(t_mediasettings_audiosettings *x, t_symbol*s, int argc, t_atom*argv) {
+  (void)s;
+  if(!x->x_staged) {
+    audiosettings_params_init (x, &x->x_stage);
+    x->x_staged=1;
+    x->x_stagechanged=0;
   }
-  if(apply) {
-    audiosettings_params_apply(x);
+  x->x_stagechanged|=audiosettings_setparams_parse(x, &x->x_stage, argc, argv);
+}
+static void audiosettings_commit(t_mediasettings_audiosettings *x) {
+  t_audiosettings live;
+  if(!x->x_staged)
+    return;
+  x->x_staged=0;
+  audiosettings_autoadvance_check(x, &x->x_stage, x->x_stagechanged);
+  if(x->x_defer) {
+    audiosettings_defer(&x->x_stage, x->x_stagechanged);
+    return;
   }
+  /* only the staged parameters: the others might have changed since the first 'stage' */
+  sys_get_audio_settings(&live);
+  as_params_merge(&live, &x->x_stage, x->x_stagechanged);
+  audiosettings_params_apply(x, &live);
+}
+static void audiosettings_discard(t_mediasettings_audiosettings *x) {
+  x->x_staged=0;
+}
+
+/* 'defer 1': collect the changes of this object (and all other deferring objects)
+ *            and apply them at once
+ */
+static void audiosettings_setdefer(t_mediasettings_audiosettings *x, t_floatarg f) {
+  x->x_defer=(f!=0);
+}
+/* 'mininterval <ms>': minimum time between two deferred re-opens (for all objects) */
+static void audiosettings_mininterval(t_mediasettings_audiosettings *x, t_floatarg f) {
+  (void)x;
+  as_instance()->deferred.mininterval=(f>0)?f:0;
 }
 
 static void audiosettings_testdevices(t_mediasettings_audiosettings *x);
@@ -628,10 +1108,24 @@ static void audiosettings_testdevices(t_mediasettings_audiosettings *x);
  */
 static void audiosettings_listdrivers(t_mediasettings_audiosettings *x)
 {
-  t_as_drivers*driver=NULL;
+  const t_symkeys*drivers=&as_instance()->drivers;
+  unsigned int i;
   t_atom ap[2];
 
-  for(driver=DRIVERS; driver; driver=driver->next) {
+  if(x->x_compact) {
+    /* 'driver <name0> <id0> <name1> <id1>...' */
+    t_atom*atoms=(t_atom*)getbytes(2*drivers->count*sizeof(*atoms));
+    for(i=0; i<drivers->count; i++) {
+      SETSYMBOL(atoms+2*i+0, drivers->entries[i].name);
+      SETFLOAT (atoms+2*i+1, (t_float)(drivers->entries[i].id));
+    }
+    outlet_anything(x->x_info, gensym("driver"), 2*drivers->count, atoms);
+    freebytes(atoms, 2*drivers->count*sizeof(*atoms));
+    return;
+  }
+
+  for(i=0; i<drivers->count; i++) {
+    const t_symkey*driver=drivers->entries+i;
     SETSYMBOL(ap+0, driver->name);
     SETFLOAT (ap+1, (t_float)(driver->id));
     outlet_anything(x->x_info, gensym("driver"), 2, ap);
@@ -639,6 +1133,7 @@ static void audiosettings_listdrivers(t_mediasettings_audiosettings *x)
 }
 
 static void audiosettings_setdriver(t_mediasettings_audiosettings *x, t_symbol*s, int argc, t_atom*argv) {
+  t_as_instance*inst=as_instance();
   int id=-1;
   s=gensym("<unknown>"); /* just re-use the argument, which is not needed anyhow */
   switch(argc) {
@@ -660,43 +1155,571 @@ static void audiosettings_setdriver(t_mediasettings_audiosettings *x, t_symbol*s
     pd_error(x, "invalid driver '%s'", s->s_name);
     return;
   }
+  if(id==as_get_audio_api() && audio_isopen()) {
+    verbose(1, "driver '%s' already running", s->s_name);
+    return;
+  }
   verbose(1, "setting driver '%s' (=%d)", s->s_name, id);
 
-  sys_close_audio();
+  devcache_invalidate(&inst->devices);
+  inst->deferred.lastapply=clock_getlogicaltime();
+  as_close_audio();
   sys_set_audio_api(id);
-  sys_reopen_audio();
+  as_reopen_audio();
+}
+
+/* 'save <name>': store driver, devices (by name) and parameters as a profile */
+static void audiosettings_save_devices(t_binbuf*b, const char*dir, const t_symkeys*devices,
+                                       int ndevs, const int*devs, const int*chans) {
+  int i;
+  binbuf_addv(b, "s", gensym(dir));
+  for(i=0; i<ndevs; i++) {
+    t_symbol*name=symkeys_getname(devices, devs[i]);
+    if(name)
+      binbuf_addv(b, "si", name, chans[i]);
+    else
+      binbuf_addv(b, "ii", devs[i], chans[i]);
+  }
+  binbuf_addsemi(b);
+}
+static void audiosettings_save(t_mediasettings_audiosettings *x, t_symbol*name) {
+  char file[MAXPDSTRING];
+  const char*dir;
+  t_binbuf*b=binbuf_new();
+  const t_devcache*devices=as_getdevices();
+  t_audiosettings params;
+  sys_get_audio_settings(&params);
+
+  binbuf_addv(b, "ss;", gensym("driver"), as_getdrivername(as_get_audio_api()));
+  binbuf_addv(b, "si;", gensym("rate"), params.a_srate);
+  binbuf_addv(b, "si;", gensym("advance"), params.a_advance);
+  binbuf_addv(b, "si;", gensym("callback"), params.a_callback);
+  binbuf_addv(b, "si;", gensym("blocksize"), params.a_blocksize);
+  audiosettings_save_devices(b, "input" , &devices->indevs , params.a_nindev , params.a_indevvec , params.a_chindevvec );
+  audiosettings_save_devices(b, "output", &devices->outdevs, params.a_noutdev, params.a_outdevvec, params.a_choutdevvec);
+
+  profile_path(name, x->x_canvas, "audiosettings", file, MAXPDSTRING, &dir);
+  if(binbuf_write(b, file, dir, 0))
+    pd_error(x, "unable to save profile '%s'", file);
+  binbuf_free(b);
+}
+
+/* 'load <name>': restore a profile (with a single re-open)
+ * devices are looked up by name in the devices of the profile's driver */
+typedef struct _as_profile {
+  t_mediasettings_audiosettings*x;
+  t_audiosettings params;
+  unsigned int changed;
+  int api;
+  const t_devcache*devices;
+} t_as_profile;
+static void audiosettings_load_driver(void*owner, t_symbol*s, int argc, t_atom*argv) {
+  t_as_profile*profile=(t_as_profile*)owner;
+  t_symbol*driver=atom_getsymbolarg(0, argc, argv);
+  int api;
+  if(gensym("driver")!=s)
+    return;
+  api=as_getdriverid(driver);
+  if(api<0)
+    pd_error(profile->x, "profile uses unknown driver '%s': keeping the current one", driver->s_name);
+  else
+    profile->api=api;
+}
+static void audiosettings_load_param(void*owner, t_symbol*s, int argc, t_atom*argv) {
+  t_as_profile*profile=(t_as_profile*)owner;
+  t_audiosettings*params=&profile->params;
+  const t_paramspec*spec=0;
+  int accepted=0;
+  if(gensym("driver")==s)
+    return;
+  if(gensym("input")==s) {
+    spec=as_paramspecs+PARAM_INPUT;
+    accepted=audiosettings_setparams_devpairs(profile->x, spec, argc, argv, profile->devices, 0,
+                                              params->a_indevvec, params->a_chindevvec,
+                                              &params->a_nindev, &params->a_nchindev);
+  } else if(gensym("output")==s) {
+    spec=as_paramspecs+PARAM_OUTPUT;
+    accepted=audiosettings_setparams_devpairs(profile->x, spec, argc, argv, profile->devices, 1,
+                                              params->a_outdevvec, params->a_choutdevvec,
+                                              &params->a_noutdev, &params->a_nchoutdev);
+  } else {
+    profile->changed|=profile_parseparam(&as_instance()->params, profile->x, params, s, argc, argv);
+    return;
+  }
+  if(accepted)
+    profile->changed|=(1<<spec->target);
+  else
+    pd_error(profile->x, "ignoring invalid setting '%s' in profile", s->s_name);
+}
+static void audiosettings_load(t_mediasettings_audiosettings *x, t_symbol*name) {
+  char file[MAXPDSTRING];
+  const char*dir;
+  t_binbuf*b=binbuf_new();
+  t_as_profile profile;
+
+  profile_path(name, x->x_canvas, "audiosettings", file, MAXPDSTRING, &dir);
+  if(binbuf_read(b, file, (char*)dir, 0)) {
+    pd_error(x, "unable to load profile '%s'", file);
+    binbuf_free(b);
+    return;
+  }
+
+  profile.x=x;
+  profile.changed=0;
+  profile.api=as_get_audio_api();
+  profile_foreach(b, audiosettings_load_driver, &profile);
+
+#if AUDIOSETTINGS_API == 0
+  /* we can only enumerate the devices of the running driver */
+  if(profile.api!=as_get_audio_api()) {
+    t_atom a;
+    SETFLOAT(&a, profile.api);
+    audiosettings_setdriver(x, 0, 1, &a);
+  }
+#endif
+  profile.devices=as_getdevices_api(profile.api);
+  audiosettings_params_init(x, &profile.params);
+  profile.params.a_api=profile.api;
+  profile_foreach(b, audiosettings_load_param, &profile);
+  binbuf_free(b);
+
+  audiosettings_autoadvance_check(x, &profile.params, profile.changed);
+  audiosettings_params_apply(x, &profile.params);
+}
+
+/* 'prefer [@timeout <ms>] <driver> <device> [@<param> <values>...] | <driver> <device> ...'
+ * tries the candidates in order, until one of them is (still) open after <timeout> msecs,
+ * and outputs 'prefer <index> <driver> <device>' (or 'prefer -1' if none worked)
+ * <driver> and <device> can be '*' (keep the current one);
+ * <device> is looked up by name (like '@input'/'@output') for both directions
+ */
+static void audiosettings_prefer_clear(t_mediasettings_audiosettings *x) {
+  t_as_prefer*prefer=&x->x_prefer;
+  clock_unset(prefer->clock);
+  if(prefer->argv)
+    freebytes(prefer->argv, prefer->argc*sizeof(*prefer->argv));
+  prefer->argv=0;
+  prefer->argc=prefer->pos=prefer->index=0;
+}
+/* a single device (with the channels of the first one currently used) */
+static void as_prefer_setdev(int dev, int*devs, int*chans, int*ndevs, int*nchans) {
+  int ch=(*ndevs>0 && chans[0]>0)?chans[0]:SYS_DEFAULTCH;
+  if(dev<0) {
+    *ndevs=*nchans=0;
+    return;
+  }
+  devs[0]=dev;
+  chans[0]=ch;
+  *ndevs=*nchans=1;
+}
+/* applies the candidate; returns 0 if it can be skipped right away */
+static int audiosettings_prefer_try(t_mediasettings_audiosettings *x, int argc, t_atom*argv) {
+  t_symbol*s_any=gensym("*");
+  t_symbol*driver=atom_getsymbolarg(0, argc, argv);
+  int api=as_get_audio_api();
+  const t_devcache*devices;
+  t_audiosettings params;
+  unsigned int changed;
+
+  if(argc<2) {
+    pd_error(x, "prefer: expected <driver> <device> [@<param> <values>...]");
+    return 0;
+  }
+  if(s_any!=driver) {
+    api=as_getdriverid(driver);
+    if(api<0) {
+      verbose(1, "prefer: skipping unknown driver '%s'", driver->s_name);
+      return 0;
+    }
+  }
+#if AUDIOSETTINGS_API == 0
+  /* we can only enumerate the devices of the running driver */
+  if(api!=as_get_audio_api()) {
+    t_atom a;
+    SETFLOAT(&a, api);
+    audiosettings_setdriver(x, 0, 1, &a);
+  }
+#endif
+  devices=as_getdevices_api(api);
+  audiosettings_params_init(x, &params);
+  params.a_api=api;
+
+  if(A_FLOAT==argv[1].a_type || s_any!=atom_getsymbol(argv+1)) {
+    int in, out;
+    if(A_FLOAT==argv[1].a_type) {
+      in=out=atom_getint(argv+1);
+    } else {
+      t_symbol*name=atom_getsymbol(argv+1);
+      in =devindex_find(&devices->inindex , &devices->indevs , name);
+      out=devindex_find(&devices->outindex, &devices->outdevs, name);
+      if(in<0 && out<0) {
+        verbose(1, "prefer: no device matching '%s'", name->s_name);
+        return 0;
+      }
+    }
+    as_prefer_setdev(in , params.a_indevvec , params.a_chindevvec , &params.a_nindev , &params.a_nchindev );
+    as_prefer_setdev(out, params.a_outdevvec, params.a_choutdevvec, &params.a_noutdev, &params.a_nchoutdev);
+  }
+  changed=audiosettings_setparams_parse(x, &params, argc-2, argv+2);
+  audiosettings_autoadvance_check(x, &params, changed);
+  audiosettings_params_apply(x, &params);
+  return audio_isopen();
+}
+/* try the candidates from prefer->pos on, until one of them opens */
+static void audiosettings_prefer_next(t_mediasettings_audiosettings *x) {
+  t_as_prefer*prefer=&x->x_prefer;
+  t_symbol*s_sep=gensym("|");
+  while(prefer->pos<prefer->argc) {
+    t_atom*argv=prefer->argv+prefer->pos;
+    int argc=0;
+    while(prefer->pos+argc<prefer->argc && !(A_SYMBOL==argv[argc].a_type && s_sep==atom_getsymbol(argv+argc)))
+      argc++;
+    if(audiosettings_prefer_try(x, argc, argv)) {
+      clock_delay(prefer->clock, prefer->timeout);
+      return;
+    }
+    prefer->pos+=argc+1;
+    prefer->index++;
+  }
+  {
+    t_atom a;
+    SETFLOAT(&a, -1);
+    outlet_anything(x->x_info, gensym("prefer"), 1, &a);
+  }
+  pd_error(x, "prefer: none of the candidates could be opened");
+  audiosettings_prefer_clear(x);
+}
+static void audiosettings_prefer_tick(t_mediasettings_audiosettings *x) {
+  t_as_prefer*prefer=&x->x_prefer;
+  t_atom*argv=prefer->argv+prefer->pos;
+  if(audio_isopen()) {
+    /* 'prefer <index> <driver> <device>' */
+    t_atom atoms[3];
+    SETFLOAT(atoms+0, (t_float)prefer->index);
+    atoms[1]=argv[0];
+    atoms[2]=argv[1];
+    outlet_anything(x->x_info, gensym("prefer"), 3, atoms);
+    audiosettings_prefer_clear(x);
+    return;
+  }
+  /* didn't last: skip to the next candidate */
+  while(prefer->pos<prefer->argc && !(A_SYMBOL==prefer->argv[prefer->pos].a_type
+                                      && gensym("|")==atom_getsymbol(prefer->argv+prefer->pos)))
+    prefer->pos++;
+  prefer->pos++;
+  prefer->index++;
+  audiosettings_prefer_next(x);
+}
+static void audiosettings_prefer(t_mediasettings_audiosettings *x, t_symbol*s, int argc, t_atom*argv) {
+  t_as_prefer*prefer=&x->x_prefer;
+  (void)s;
+  audiosettings_prefer_clear(x);
+  prefer->timeout=AS_PREFER_TIMEOUT;
+  if(argc>1 && A_SYMBOL==argv->a_type && gensym("@timeout")==atom_getsymbol(argv)) {
+    prefer->timeout=atom_getfloat(argv+1);
+    if(prefer->timeout<0)
+      prefer->timeout=0;
+    argc-=2;
+    argv+=2;
+  }
+  if(!argc)
+    return;
+  prefer->argc=argc;
+  prefer->argv=(t_atom*)getbytes(argc*sizeof(*argv));
+  memcpy(prefer->argv, argv, argc*sizeof(*argv));
+  audiosettings_prefer_next(x);
+}
+
+/* 'watchdog 1': re-open the audio device if it went away (e.g. a USB interface dropped out),
+ * Pd closed it because audio I/O got stuck, or it stays open but keeps stalling
+ * (I/O errors in AS_WATCHDOG_STALLS consecutive checks)
+ * outputs 'watchdog down' and 'watchdog recovered <downtime> <attempts>'
+ */
+static void as_watchdog_names(t_symbol**names, const t_symkeys*devices, int ndevs, const int*devs) {
+  int i;
+  for(i=0; i<ndevs; i++)
+    names[i]=symkeys_getname(devices, devs[i]);
+}
+#define AS_WATCHDOG_STALLS 3
+static int audiosettings_watchdog_check(void*owner) {
+  t_mediasettings_audiosettings *x=(t_mediasettings_audiosettings *)owner;
+  t_as_instance*inst=as_instance();
+  unsigned long errors=as_stats_poll(&x->x_wdstats);
+#if AUDIOSETTINGS_API == 1
+  if(!pd_getdspstate())
+    return 1; /* nothing to watch */
+#endif
+  if(!audio_isopen())
+    return 0;
+  x->x_wdstalls=errors?(x->x_wdstalls+1):0;
+  if(x->x_wdstats.count[IOERR_STUCK] || x->x_wdstalls>=AS_WATCHDOG_STALLS)
+    return 0;
+  /* remember the working setup (without forcing an enumeration) */
+  sys_get_audio_settings(&x->x_wdparams);
+  if(devcache_isvalid(&inst->devices, x->x_wdparams.a_api)) {
+    as_watchdog_names(x->x_wdindevs , &inst->devices.indevs , x->x_wdparams.a_nindev , x->x_wdparams.a_indevvec );
+    as_watchdog_names(x->x_wdoutdevs, &inst->devices.outdevs, x->x_wdparams.a_noutdev, x->x_wdparams.a_outdevvec);
+  }
+  return 1;
+}
+/* look up the devices by name again: they might have new ids */
+static int as_watchdog_resolve(t_symbol**names, const t_symkeys*devices, int ndevs, int*devs) {
+  int i;
+  for(i=0; i<ndevs; i++) {
+    int id;
+    if(!names[i])
+      continue;
+    id=symkeys_getid(devices, names[i]);
+    if(id<0)
+      return 0;
+    devs[i]=id;
+  }
+  return 1;
+}
+static int audiosettings_watchdog_reopen(void*owner) {
+  t_mediasettings_audiosettings *x=(t_mediasettings_audiosettings *)owner;
+  t_as_instance*inst=as_instance();
+  t_audiosettings params=x->x_wdparams;
+  const t_devcache*devices;
+
+  devcache_invalidate(&inst->devices);
+  devices=as_getdevices_api(params.a_api);
+  if(!as_watchdog_resolve(x->x_wdindevs , &devices->indevs , params.a_nindev , params.a_indevvec )
+     || !as_watchdog_resolve(x->x_wdoutdevs, &devices->outdevs, params.a_noutdev, params.a_outdevvec))
+    return 0; /* not back yet */
+
+  inst->deferred.lastapply=clock_getlogicaltime();
+  if(!audiosettings_params_apply_direct(x, &params)) {
+    as_close_audio();
+    as_reopen_audio();
+  }
+  as_stats_reset(&x->x_wdstats);
+  x->x_wdstalls=0;
+  return audio_isopen();
+}
+static void audiosettings_watchdog_event(void*owner, t_symbol*event, double downtime, int attempts) {
+  t_mediasettings_audiosettings *x=(t_mediasettings_audiosettings *)owner;
+  t_atom atoms[3];
+  SETSYMBOL(atoms+0, event);
+  SETFLOAT (atoms+1, (t_float)downtime);
+  SETFLOAT (atoms+2, (t_float)attempts);
+  outlet_anything(x->x_info, gensym("watchdog"), (attempts>0)?3:1, atoms);
+}
+static void audiosettings_watchdog(t_mediasettings_audiosettings *x, t_floatarg f) {
+#if AUDIOSETTINGS_API == 0
+  if(f!=0) {
+    pd_error(x, "watchdog: needs Pd>=0.52");
+    return;
+  }
+#endif
+  if(f!=0) {
+    int i;
+    sys_get_audio_settings(&x->x_wdparams);
+    for(i=0; i<MAXAUDIOINDEV; i++) x->x_wdindevs[i]=0;
+    for(i=0; i<MAXAUDIOOUTDEV; i++) x->x_wdoutdevs[i]=0;
+    as_getdevices(); /* so we know the devices by name */
+    as_stats_reset(&x->x_wdstats);
+    x->x_wdstalls=0;
+    audiosettings_watchdog_check(x);
+  }
+  watchdog_set(&x->x_watchdog, (f!=0));
+}
+
+/* 'timings <call> <count> <min> <avg> <max> <p99>' for each backend call (in msec) */
+static void audiosettings_timings(t_mediasettings_audiosettings *x) {
+  timing_output(x->x_info, as_instance()->timings, TIMING_COUNT);
+}
+
+/* forget about the cached devices, so they are probed again on the next query */
+static void audiosettings_refresh(t_mediasettings_audiosettings *x) {
+  (void)x;
+  devcache_invalidate(&as_instance()->devices);
+}
+
+/* 'added <name>' resp. 'removed <name>' whenever a device node comes or goes */
+static void audiosettings_hotplug(void*owner, t_symbol*event, t_symbol*name) {
+  t_mediasettings_audiosettings *x=(t_mediasettings_audiosettings *)owner;
+  t_atom ap[1];
+  SETSYMBOL(ap+0, name);
+  outlet_anything(x->x_info, event, 1, ap);
+}
+static void audiosettings_watch(t_mediasettings_audiosettings *x, t_symbol*s, int argc, t_atom*argv) {
+  (void)s;
+  hotplug_watch(&x->x_hotplug, x, argc, argv);
+}
+
+/* 'stats <type> <count> <count/sec> <total>' for each error type, every <interval> msecs */
+static void audiosettings_stats_tick(t_mediasettings_audiosettings *x) {
+  t_as_stats*stats=&x->x_stats;
+  t_symbol*s_stats=gensym("stats");
+  int i;
+
+  as_stats_poll(stats);
+
+  for(i=0; i<IOERR_COUNT; i++) {
+    t_atom atoms[4];
+    stats->total[i]+=stats->count[i];
+    SETSYMBOL(atoms+0, gensym(as_ioerror_names[i]));
+    SETFLOAT (atoms+1, (t_float)stats->count[i]);
+    SETFLOAT (atoms+2, (t_float)(stats->window>0?(stats->count[i]*1000./stats->window):0));
+    SETFLOAT (atoms+3, (t_float)stats->total[i]);
+    outlet_anything(x->x_info, s_stats, 4, atoms);
+  }
+  clock_delay(stats->clock, stats->interval);
+}
+
+/* 'stats unsupported <type>...': the error types Pd doesn't let us count */
+static void as_stats_unsupported(t_mediasettings_audiosettings *x) {
+  t_atom atoms[1+sizeof(as_ioerror_unsupported)/sizeof(*as_ioerror_unsupported)];
+  unsigned int i;
+  SETSYMBOL(atoms+0, gensym("unsupported"));
+  for(i=0; i<sizeof(as_ioerror_unsupported)/sizeof(*as_ioerror_unsupported); i++)
+    SETSYMBOL(atoms+1+i, gensym(as_ioerror_unsupported[i]));
+  outlet_anything(x->x_info, gensym("stats"), 1+i, atoms);
+}
+
+/* 'stats <interval>': periodically report audio I/O errors (0 turns it off) */
+static void audiosettings_stats(t_mediasettings_audiosettings *x, t_floatarg f) {
+  t_as_stats*stats=&x->x_stats;
+  clock_unset(stats->clock);
+  stats->interval=(f>0)?f:0;
+  if(!stats->interval)
+    return;
+  memset(stats->total, 0, sizeof(stats->total));
+  as_stats_reset(stats);
+  clock_delay(stats->clock, stats->interval);
+  as_stats_unsupported(x);
+}
+
+/* 'compact 1': output lists as a single message (rather than one message per entry) */
+static void audiosettings_compact(t_mediasettings_audiosettings *x, t_floatarg f) {
+  x->x_compact=(f!=0);
+}
+
+/* query a single setting:
+ * 'get rate|advance|callback|blocksize|in|out' (current parameters)
+ * 'get driver|drivers|multi|in devices|out devices' (current driver and its devices)
+ */
+static void audiosettings_get(t_mediasettings_audiosettings *x, t_symbol*s, int argc, t_atom*argv) {
+  t_symbol*what=atom_getsymbolarg(0, argc, argv);
+  t_symbol*sub =atom_getsymbolarg(1, argc, argv);
+  t_symbol*s_params=gensym("params"), *s_device=gensym("device");
+  t_audiosettings params;
+  (void)s;
+
+  if(gensym("in")==what || gensym("out")==what) {
+    int in=(gensym("in")==what);
+    if(gensym("devices")==sub) {
+      const t_devcache*devices=as_getdevices();
+      audiosettings_listdevices_dir(x, what->s_name, in?&devices->indevs:&devices->outdevs);
+      return;
+    }
+    sys_get_audio_settings(&params);
+    if(in)
+      audiosettings_listparams_dir(x, "in" , params.a_nindev , params.a_indevvec , params.a_chindevvec );
+    else
+      audiosettings_listparams_dir(x, "out", params.a_noutdev, params.a_outdevvec, params.a_choutdevvec);
+  } else if(gensym("rate")==what || gensym("samplerate")==what) {
+    sys_get_audio_settings(&params);
+    audiosettings_output_float(x, s_params, "rate", params.a_srate);
+  } else if(gensym("advance")==what) {
+    sys_get_audio_settings(&params);
+    audiosettings_output_float(x, s_params, "advance", params.a_advance);
+  } else if(gensym("callback")==what) {
+    sys_get_audio_settings(&params);
+    audiosettings_output_float(x, s_params, "callback", params.a_callback);
+  } else if(gensym("blocksize")==what) {
+    sys_get_audio_settings(&params);
+    audiosettings_output_float(x, s_params, "blocksize", params.a_blocksize);
+  } else if(gensym("driver")==what) {
+    t_atom a;
+    SETSYMBOL(&a, as_getdrivername(as_get_audio_api()));
+    audiosettings_output_value(x, s_device, "driver", &a);
+  } else if(gensym("drivers")==what) {
+    audiosettings_listdrivers(x);
+  } else if(gensym("multi")==what) {
+    audiosettings_output_float(x, s_device, "multi", as_getdevices()->canmulti);
+  } else {
+    pd_error(x, "unknown query '%s'", what->s_name);
+  }
 }
 
 static void audiosettings_bang(t_mediasettings_audiosettings *x) {
   audiosettings_listdrivers(x);
-  audiosettings_listdevices(x);
+  audiosettings_listdevices(x, 0, 0, 0);
   audiosettings_listparams(x);
 }
 
 
 static void audiosettings_free(t_mediasettings_audiosettings *x){
-  (void)x;
+  hotplug_stop(&x->x_hotplug);
+  devprobe_stop(&x->x_probe);
+  devprobe_free(&x->x_probe);
+  clock_free(x->x_stats.clock);
+  clock_free(x->x_autoadvance.clock);
+  audiosettings_prefer_clear(x);
+  clock_free(x->x_prefer.clock);
+  watchdog_free(&x->x_watchdog);
+  msinstance_release(&as_instances, &as_instance()->i_instance, sizeof(t_as_instance), as_instance_free);
 }
 
 
+/* called (once per Pd-instance) when the first [audiosettings] is created */
+static void as_instance_init(t_msinstance*i) {
+  t_as_instance*inst=(t_as_instance*)i;
+  inst->pdsym=gensym("pd");
+  paramschema_init(&inst->params, as_paramspecs, PARAM_COUNT);
+  timing_init(inst->timings, as_timing_names, TIMING_COUNT);
+  if(!as_diskcache_load(inst)) {
+    char buf[MAXPDSTRING];
+    double start=timing_now();
+    sys_get_audio_apis(buf);
+    timing_stop(inst->timings+TIMING_GET_APIS, start);
+    apilist_parsedrivers(&inst->drivers, buf);
+  }
+}
+/* called when the last [audiosettings] of the Pd-instance is deleted
+ * (a pending deferred apply is dropped) */
+static void as_instance_free(t_msinstance*i) {
+  t_as_instance*inst=(t_as_instance*)i;
+  devprobe_stop(&inst->diskprobe);
+  devprobe_free(&inst->diskprobe);
+  devprobe_free(&inst->probe);
+  if(inst->deferred.clock)
+    clock_free(inst->deferred.clock);
+  symkeys_free(&inst->drivers);
+  devcache_free(&inst->devices);
+  paramschema_free(&inst->params);
+}
+
 static void *audiosettings_new(void)
 {
   t_mediasettings_audiosettings *x = (t_mediasettings_audiosettings *)pd_new(audiosettings_class);
+  t_as_instance*inst=as_instance();
+  msinstance_acquire(&inst->i_instance);
   x->x_info=outlet_new(&x->x_obj, 0);
-
-  char buf[MAXPDSTRING];
-  sys_get_audio_apis(buf);
-
-  DRIVERS=as_driverparse(DRIVERS, buf);
-  audiosettings_params_init (x);
+  x->x_canvas=canvas_getcurrent();
+  devprobe_init(&x->x_probe, &inst->i_instance, x, as_probe, audiosettings_listdevices_done);
+  hotplug_init(&x->x_hotplug, &inst->i_instance, x, &inst->devices, audiosettings_hotplug);
+  audiosettings_params_init (x, &x->x_params);
+  x->x_staged=0;
+  x->x_defer=0;
+  x->x_compact=0;
+  memset(&x->x_stats, 0, sizeof(x->x_stats));
+  x->x_stats.clock=clock_new(x, (t_method)audiosettings_stats_tick);
+  memset(&x->x_autoadvance, 0, sizeof(x->x_autoadvance));
+  x->x_autoadvance.clock=clock_new(x, (t_method)audiosettings_autoadvance_tick);
+  x->x_autoadvance.window=AS_AUTOADVANCE_WINDOW;
+  memset(&x->x_prefer, 0, sizeof(x->x_prefer));
+  x->x_prefer.clock=clock_new(x, (t_method)audiosettings_prefer_tick);
+  watchdog_init(&x->x_watchdog, x,
+                audiosettings_watchdog_check, audiosettings_watchdog_reopen, audiosettings_watchdog_event);
   return (x);
 }
 
 
 void audiosettings_setup(void)
 {
-  s_pdsym=gensym("pd");
-
   mediasettings_boilerplate("[audiosettings] audio settings manager", AUDIOSETTINGS_VERSION);
 
   audiosettings_class = class_new(gensym("audiosettings"),
@@ -705,14 +1728,29 @@ void audiosettings_setup(void)
 
   class_addbang(audiosettings_class, (t_method)audiosettings_bang);
   class_addmethod(audiosettings_class, (t_method)audiosettings_listdrivers, gensym("listdrivers"), A_NULL);
-  class_addmethod(audiosettings_class, (t_method)audiosettings_listdevices, gensym("listdevices"), A_NULL);
+  class_addmethod(audiosettings_class, (t_method)audiosettings_listdevices, gensym("listdevices"), A_GIMME, A_NULL);
   class_addmethod(audiosettings_class, (t_method)audiosettings_listparams, gensym("listparams"), A_NULL);
+  class_addmethod(audiosettings_class, (t_method)audiosettings_refresh, gensym("refresh"), A_NULL);
+  class_addmethod(audiosettings_class, (t_method)audiosettings_get, gensym("get"), A_GIMME, A_NULL);
+  class_addmethod(audiosettings_class, (t_method)audiosettings_compact, gensym("compact"), A_FLOAT, A_NULL);
+  class_addmethod(audiosettings_class, (t_method)audiosettings_watch, gensym("watch"), A_GIMME, A_NULL);
 
 
   class_addmethod(audiosettings_class, (t_method)audiosettings_setdriver, gensym("driver"), A_GIMME, A_NULL);
   class_addmethod(audiosettings_class, (t_method)audiosettings_setparams, gensym("params"), A_GIMME, A_NULL);
+  class_addmethod(audiosettings_class, (t_method)audiosettings_stage, gensym("stage"), A_GIMME, A_NULL);
+  class_addmethod(audiosettings_class, (t_method)audiosettings_commit, gensym("commit"), A_NULL);
+  class_addmethod(audiosettings_class, (t_method)audiosettings_discard, gensym("discard"), A_NULL);
+  class_addmethod(audiosettings_class, (t_method)audiosettings_setdefer, gensym("defer"), A_FLOAT, A_NULL);
+  class_addmethod(audiosettings_class, (t_method)audiosettings_mininterval, gensym("mininterval"), A_FLOAT, A_NULL);
 
   class_addmethod(audiosettings_class, (t_method)audiosettings_testdevices, gensym("testdevices"), A_NULL);
+  class_addmethod(audiosettings_class, (t_method)audiosettings_timings, gensym("timings"), A_NULL);
+  class_addmethod(audiosettings_class, (t_method)audiosettings_stats, gensym("stats"), A_FLOAT, A_NULL);
+  class_addmethod(audiosettings_class, (t_method)audiosettings_save, gensym("save"), A_SYMBOL, A_NULL);
+  class_addmethod(audiosettings_class, (t_method)audiosettings_load, gensym("load"), A_SYMBOL, A_NULL);
+  class_addmethod(audiosettings_class, (t_method)audiosettings_prefer, gensym("prefer"), A_GIMME, A_NULL);
+  class_addmethod(audiosettings_class, (t_method)audiosettings_watchdog, gensym("watchdog"), A_FLOAT, A_NULL);
 
 }
 
@@ -720,27 +1758,23 @@ void audiosettings_setup(void)
 static void audiosettings_testdevices(t_mediasettings_audiosettings *x)
 {
   int i;
-
-  char indevlist[MAXNDEV][DEVDESCSIZE], outdevlist[MAXNDEV][DEVDESCSIZE];
-  int indevs = 0, outdevs = 0, canmulti = 0, cancallback = 0;
-  int api = 0;
+  unsigned int j;
+  const t_devcache*devices=as_getdevices();
 
   if(0) {
     pd_error(x, "this should never happen");
   }
 
-  as_get_audio_devs((char*)indevlist, &indevs, (char*)outdevlist, &outdevs, &canmulti,
-      &cancallback, MAXNDEV, DEVDESCSIZE, &api);
-
-  post("%d indevs", indevs);
-  for(i=0; i<indevs; i++)
-    post("\t#%02d: %s", i, indevlist[i]);
+  post("%d indevs", devices->indevs.count);
+  for(j=0; j<devices->indevs.count; j++)
+    post("\t#%02d: %s", j, devices->indevs.entries[j].name->s_name);
 
-  post("%d outdevs", outdevs);
-  for(i=0; i<outdevs; i++)
-    post("\t#%02d: %s", i, outdevlist[i]);
+  post("%d outdevs", devices->outdevs.count);
+  for(j=0; j<devices->outdevs.count; j++)
+    post("\t#%02d: %s", j, devices->outdevs.entries[j].name->s_name);
 
-  post("multi: %d\tcallback: %d", canmulti, cancallback);
+  post("multi: %d\tcallback: %d", devices->canmulti, devices->cancallback);
+  timing_post(as_instance()->timings, TIMING_COUNT);
 
   endpost();
 
@@ -0,0 +1,202 @@
+/* tests for the ALSA sequencer ports (in alsaseq.h)
+ *
+ * usage: alsaseq-test [<iterations>]
+ * creates a few virtual sequencer clients in-process (a fake Pd, a source
+ * and a sink), so it needs the 'snd-seq' kernel module but no MIDI hardware.
+ * returns non-zero if any test fails (and skips the tests if there is no sequencer)
+ */
+#include "mockpd.h"
+#include "mediasettings.h"
+#include "alsaseq.h"
+
+#include <time.h>
+
+#ifndef MEDIASETTINGS_ALSASEQ
+# error alsaseq-test needs HAVE_ALSA
+#endif
+
+static int failures=0;
+#define CHECK(cond) do { \
+    if(!(cond)) { \
+      fprintf(stderr, "%s:%d: FAILED: %s\n", __FILE__, __LINE__, #cond); \
+      failures++; \
+    } } while(0)
+
+static double test_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1e6 + ts.tv_nsec*1e-3; /* usec */
+}
+
+/* a virtual client with a single port */
+typedef struct _client {
+  snd_seq_t*seq;
+  snd_seq_addr_t addr;
+} t_client;
+static int client_open(t_client*c, const char*name, const char*portname, unsigned int caps) {
+  int port;
+  if(snd_seq_open(&c->seq, "default", SND_SEQ_OPEN_DUPLEX, SND_SEQ_NONBLOCK)<0)
+    return 0;
+  snd_seq_set_client_name(c->seq, name);
+  port=snd_seq_create_simple_port(c->seq, portname, caps, SND_SEQ_PORT_TYPE_MIDI_GENERIC|SND_SEQ_PORT_TYPE_APPLICATION);
+  CHECK(port>=0);
+  c->addr.client=(unsigned char)snd_seq_client_id(c->seq);
+  c->addr.port=(unsigned char)port;
+  return 1;
+}
+
+static t_symbol*client_portname(const t_client*c, const char*portname) {
+  char buf[MAXPDSTRING];
+  snd_seq_client_info_t*cinfo;
+  snd_seq_client_info_alloca(&cinfo);
+  snd_seq_get_client_info(c->seq, cinfo);
+  snprintf(buf, sizeof(buf), "%s:%s", snd_seq_client_info_get_name(cinfo), portname);
+  return gensym(buf);
+}
+
+static int resolve(const t_alsaseq*seq, const char*name, snd_seq_addr_t*addr) {
+  t_atom a;
+  SETSYMBOL(&a, gensym(name));
+  return alsaseq_resolve(seq, &a, addr);
+}
+static int subscribed(const t_client*c, const snd_seq_addr_t*sender, const snd_seq_addr_t*dest) {
+  snd_seq_port_subscribe_t*subs;
+  snd_seq_port_subscribe_alloca(&subs);
+  snd_seq_port_subscribe_set_sender(subs, sender);
+  snd_seq_port_subscribe_set_dest(subs, dest);
+  return !snd_seq_get_port_subscription(c->seq, subs);
+}
+
+static void test_count(void*owner, const snd_seq_addr_t*sender, const snd_seq_addr_t*dest) {
+  (void)sender; (void)dest;
+  (*(int*)owner)++;
+}
+
+static t_client pd, source, sink;
+/* stands in for the generation of the MIDI device cache */
+static unsigned int generation=0;
+
+static void test_snapshot(t_alsaseq*seq) {
+  snd_seq_addr_t addr;
+  const t_alsaseq_port*port;
+  int late;
+  CHECK(alsaseq_update(seq, generation));
+  CHECK(seq->count>=4);
+
+  /* Pd's ports (in the order they were created) */
+  CHECK(seq->pdclient == pd.addr.client);
+  port=alsaseq_pdport(seq, 1, 0);
+  CHECK(port && port->port == pd.addr.port);
+  CHECK(!alsaseq_pdport(seq, 1, 1));
+
+  /* by (unique) name, by address and by client */
+  CHECK(!resolve(seq, client_portname(&source, "out")->s_name, &addr));
+  CHECK(addr.client == source.addr.client && addr.port == source.addr.port);
+  CHECK(!resolve(seq, "alsaseq-test-sink", &addr));
+  CHECK(addr.client == sink.addr.client && addr.port == sink.addr.port);
+  CHECK(DEVINDEX_AMBIGUOUS == resolve(seq, "alsaseq-test", &addr));
+  CHECK(DEVINDEX_NOTFOUND == resolve(seq, "no-such-port", &addr));
+  CHECK(!resolve(seq, "12:34", &addr));
+  CHECK(addr.client == 12 && addr.port == 34);
+  CHECK(DEVINDEX_NOTFOUND == resolve(seq, "300:0", &addr));
+  CHECK(DEVINDEX_NOTFOUND == resolve(seq, "12:256", &addr));
+
+  /* a new port is announced by the sequencer, and the snapshot is re-taken */
+  late=snd_seq_create_simple_port(source.seq, "late", SND_SEQ_PORT_CAP_READ|SND_SEQ_PORT_CAP_SUBS_READ,
+                                  SND_SEQ_PORT_TYPE_MIDI_GENERIC);
+  CHECK(late>=0);
+  CHECK(alsaseq_update(seq, generation));
+  CHECK(!resolve(seq, client_portname(&source, "late")->s_name, &addr));
+  snd_seq_delete_simple_port(source.seq, late);
+  CHECK(alsaseq_update(seq, generation));
+  CHECK(DEVINDEX_NOTFOUND == resolve(seq, client_portname(&source, "late")->s_name, &addr));
+
+  /* ...as it is after a 'refresh' */
+  generation++;
+  CHECK(alsaseq_update(seq, generation));
+  CHECK(seq->count>=4);
+}
+
+/* a sequencer that can't be opened is never touched */
+static void test_unopened(void) {
+  t_alsaseq seq;
+  int count=0;
+  memset(&seq, 0, sizeof(seq));
+  seq.failed=1;
+  CHECK(-ENODEV == alsaseq_connect(&seq, &source.addr, &pd.addr, 1));
+  alsaseq_subscribers(&seq, &source.addr, test_count, &count);
+  CHECK(0 == count);
+  CHECK(!seq.seq);
+}
+
+static void test_connect(t_alsaseq*seq) {
+  int count=0;
+  CHECK(!alsaseq_connect(seq, &source.addr, &pd.addr, 1));
+  CHECK(subscribed(&pd, &source.addr, &pd.addr));
+  CHECK(-EEXIST == alsaseq_connect(seq, &source.addr, &pd.addr, 1));
+  alsaseq_subscribers(seq, &source.addr, test_count, &count);
+  CHECK(1 == count);
+
+  CHECK(!alsaseq_connect(seq, &source.addr, &pd.addr, 0));
+  CHECK(!subscribed(&pd, &source.addr, &pd.addr));
+  CHECK(alsaseq_connect(seq, &source.addr, &pd.addr, 0)<0);
+  count=0;
+  alsaseq_subscribers(seq, &source.addr, test_count, &count);
+  CHECK(0 == count);
+}
+
+/* <name> <n> <avg[us]> */
+static void test_timing(t_alsaseq*seq, int n) {
+  double start;
+  int i;
+
+  start=test_now();
+  for(i=0; i<n; i++)
+    alsaseq_update(seq, generation);
+  printf("%-24s %8d %10.3f\n", "alsaseq:cached", n, (test_now()-start)/n);
+
+  start=test_now();
+  for(i=0; i<n; i++) {
+    generation++;
+    alsaseq_update(seq, generation);
+  }
+  printf("%-24s %8d %10.3f\n", "alsaseq:snapshot", n, (test_now()-start)/n);
+
+  start=test_now();
+  for(i=0; i<n; i++) {
+    alsaseq_connect(seq, &source.addr, &sink.addr, 1);
+    alsaseq_connect(seq, &source.addr, &sink.addr, 0);
+  }
+  printf("%-24s %8d %10.3f\n", "alsaseq:(dis)connect", n, (test_now()-start)/n);
+}
+
+int main(int argc, char**argv) {
+  int n=(argc>1)?atoi(argv[1]):1000;
+  t_alsaseq seq;
+  mockpd_init(0);
+  memset(&seq, 0, sizeof(seq));
+
+  if(!client_open(&pd, ALSASEQ_PDCLIENT, "Pure Data Midi-In 1", SND_SEQ_PORT_CAP_WRITE|SND_SEQ_PORT_CAP_SUBS_WRITE)) {
+    printf("no ALSA sequencer: skipped\n");
+    return 0;
+  }
+  client_open(&source, "alsaseq-test-source", "out", SND_SEQ_PORT_CAP_READ|SND_SEQ_PORT_CAP_SUBS_READ);
+  client_open(&sink, "alsaseq-test-sink", "in", SND_SEQ_PORT_CAP_WRITE|SND_SEQ_PORT_CAP_SUBS_WRITE);
+
+  test_unopened();
+  test_snapshot(&seq);
+  test_connect(&seq);
+  printf("%-24s %8s %10s\n", "# benchmark", "n", "avg[us]");
+  test_timing(&seq, (n>0)?n:1);
+
+  alsaseq_free(&seq);
+  snd_seq_close(sink.seq);
+  snd_seq_close(source.seq);
+  snd_seq_close(pd.seq);
+
+  if(failures)
+    fprintf(stderr, "%d test(s) failed\n", failures);
+  else
+    printf("all tests passed\n");
+  return (failures>0);
+}
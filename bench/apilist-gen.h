@@ -0,0 +1,41 @@
+/* generates large API lists (as reported by sys_get_audio_apis()),
+ * mixing all the ways a driver name can be written
+ */
+#ifndef APILIST_GEN_H
+#define APILIST_GEN_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* the (unescaped) name and the id of entry #<i> */
+static void apilist_gen_entry(int i, char*name, size_t size, int*id) {
+  switch(i%4) {
+  case 0: snprintf(name, size, "drv%d", i); break;
+  case 1: snprintf(name, size, "drv %d", i); break;
+  case 2: snprintf(name, size, "drv {%d}", i); break;
+  default: snprintf(name, size, "drv %d}", i); break;
+  }
+  *id=i+1;
+}
+
+/* '{ {drv0 1} {"drv 1" 2} {{drv {2}} 3} {drv\ 3\} 4} ... }' (free() the result) */
+static char*apilist_gen(int count) {
+  size_t size=64*(size_t)count+16, len;
+  char*buf=(char*)malloc(size);
+  int i;
+  strcpy(buf, "{ ");
+  len=strlen(buf);
+  for(i=0; i<count; i++) {
+    switch(i%4) {
+    case 0: len+=sprintf(buf+len, "{drv%d %d} ", i, i+1); break;
+    case 1: len+=sprintf(buf+len, "{\"drv %d\" %d} ", i, i+1); break;
+    case 2: len+=sprintf(buf+len, "{{drv {%d}} %d} ", i, i+1); break;
+    default: len+=sprintf(buf+len, "{drv\\ %d\\} %d} ", i, i+1); break;
+    }
+  }
+  strcpy(buf+len, "}");
+  return buf;
+}
+
+#endif /* APILIST_GEN_H */
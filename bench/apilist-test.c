@@ -0,0 +1,142 @@
+/* tests for the apilist tokenizer (in mediasettings.h)
+ *
+ * usage: apilist-test [<entries>]
+ * returns non-zero if any test fails
+ */
+#include "mockpd.h"
+#include "mediasettings.h"
+#include "apilist-gen.h"
+
+static int failures=0;
+#define CHECK(cond) do { \
+    if(!(cond)) { \
+      fprintf(stderr, "%s:%d: FAILED: %s\n", __FILE__, __LINE__, #cond); \
+      failures++; \
+    } } while(0)
+
+/* parse <buf> into 'name=id;...' (for comparing against the expected result) */
+static unsigned int parse(const char*buf, char*result, size_t size) {
+  t_apilist list;
+  t_apispan span;
+  size_t len=0;
+  *result=0;
+  apilist_init(&list, buf);
+  while(apilist_next(&list, &span)) {
+    char name[MAXPDSTRING];
+    apispan_getname(&span, name, sizeof(name));
+    len+=snprintf(result+len, size-len, "%s=%d;", name, span.id);
+  }
+  return list.skipped;
+}
+static void test(const char*buf, const char*expected, unsigned int skipped) {
+  char result[MAXPDSTRING];
+  unsigned int s=parse(buf, result, sizeof(result));
+  if(strcmp(result, expected) || s!=skipped) {
+    fprintf(stderr, "FAILED: '%s'\n\tgot      '%s' (%u skipped)\n\texpected '%s' (%u skipped)\n",
+            buf, result, s, expected, skipped);
+    failures++;
+  }
+}
+
+static void test_pd(void) {
+  /* what Pd actually reports */
+  test("{ {OSS 2} {ALSA 1} {portaudio 4} {jack 5} }", "OSS=2;ALSA=1;portaudio=4;jack=5;", 0);
+  test("{}", "", 0);
+  test("", "", 0);
+  test("{ {dummy 9} {api 19} }", "dummy=9;api=19;", 0);
+  test("{ {ALSA 1} {OSS 2} }\n", "ALSA=1;OSS=2;", 0);
+}
+static void test_syntax(void) {
+  /* without the outer braces */
+  test("{ALSA 1} {JACK 5}", "ALSA=1;JACK=5;", 0);
+  /* quoted, braced and escaped names */
+  test("{ {\"Core Audio\" 7} {{Windows {MME}} 3} {ASIO\\ (portaudio) 4} }",
+       "Core Audio=7;Windows {MME}=3;ASIO (portaudio)=4;", 0);
+  test("{ {\"say \\\"hi\\\"\" 1} {{a\\}b} 2} }", "say \"hi\"=1;a}b=2;", 0);
+  test("{\t{ALSA\t1}\n{OSS 2}}", "ALSA=1;OSS=2;", 0);
+  test("{ {neg -1} }", "neg=-1;", 0);
+}
+static void test_malformed(void) {
+  test("{ {noid} {x y} {a 1 2} {b 3} {} }", "b=3;", 4);
+  test("{ {a 1} stray {b 3} }", "a=1;b=3;", 1);
+  test("{ {big 12345678901} {ok 1} }", "ok=1;", 1);
+  /* truncated */
+  test("{ {ALSA 1} {JA", "ALSA=1;", 1);
+  test("{ {ALSA 1} {JACK 5", "ALSA=1;JACK=5;", 0);
+  test("{ {\"unterminated 1} }", "", 1);
+  test("{ {{unterminated 1} }", "", 1);
+}
+static void test_truncate(void) {
+  t_apispan span;
+  char name[4];
+  span.name="abcdef";
+  span.namelen=6;
+  span.escaped=0;
+  apispan_getname(&span, name, sizeof(name));
+  CHECK(!strcmp(name, "abc"));
+  span.name="a\\ bcdef";
+  span.namelen=8;
+  span.escaped=1;
+  apispan_getname(&span, name, sizeof(name));
+  CHECK(!strcmp(name, "a b"));
+}
+
+/* a large generated list, entry by entry */
+static void test_generated(int count) {
+  char*buf=apilist_gen(count);
+  t_apilist list;
+  t_apispan span;
+  int i=0;
+  apilist_init(&list, buf);
+  while(apilist_next(&list, &span)) {
+    char name[MAXPDSTRING], expected[MAXPDSTRING];
+    int id;
+    apilist_gen_entry(i, expected, sizeof(expected), &id);
+    apispan_getname(&span, name, sizeof(name));
+    if(strcmp(name, expected) || span.id!=id) {
+      fprintf(stderr, "FAILED: entry #%d is '%s'=%d, expected '%s'=%d\n", i, name, span.id, expected, id);
+      failures++;
+      break;
+    }
+    i++;
+  }
+  CHECK(i==count);
+  CHECK(!list.skipped);
+  free(buf);
+}
+/* ...and as drivers */
+static void test_drivers(int count) {
+  char*buf=apilist_gen(count);
+  t_symkeys drivers;
+  int i;
+  symkeys_init(&drivers);
+  apilist_parsedrivers(&drivers, buf);
+  CHECK(drivers.count==(unsigned int)count);
+  for(i=0; i<count; i+=count/100+1) {
+    char expected[MAXPDSTRING];
+    int id;
+    apilist_gen_entry(i, expected, sizeof(expected), &id);
+    CHECK(symkeys_getid(&drivers, gensym(expected))==id);
+    CHECK(symkeys_getname(&drivers, id)==gensym(expected));
+  }
+  symkeys_free(&drivers);
+  free(buf);
+}
+
+int main(int argc, char**argv) {
+  int count=(argc>1)?atoi(argv[1]):100000;
+  mockpd_init(0);
+
+  test_pd();
+  test_syntax();
+  test_malformed();
+  test_truncate();
+  test_generated(count);
+  test_drivers(count);
+
+  if(failures)
+    fprintf(stderr, "%d test(s) failed\n", failures);
+  else
+    printf("all tests passed\n");
+  return (failures>0);
+}
@@ -0,0 +1,249 @@
+/* benchmark [audiosettings]/[midisettings] against a mock Pd core
+ *
+ * usage: mediasettings-bench [-n <iterations>] [-d <drivers>] [-i <indevs>] [-o <outdevs>]
+ *                            [-a <entries>] [-e <usec per enumeration>] [-v]
+ *
+ * reports throughput and latency of driver parsing, object creation,
+ * device enumeration, 'params' parsing and applying the settings
+ * (plus microbenchmarks of the API list tokenizer on large generated lists)
+ */
+#include "mockpd.h"
+#include "mediasettings.h"
+#include "apilist-gen.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+void audiosettings_setup(void);
+void midisettings_setup(void);
+
+#define BENCH_MAXARGS 64
+
+static double bench_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1e6 + ts.tv_nsec*1e-3; /* usec */
+}
+
+static int bench_cmp(const void*a, const void*b) {
+  double da=*(const double*)a, db=*(const double*)b;
+  return (da>db)-(da<db);
+}
+/* <name> <n> <total[ms]> <ops/s> <min> <avg> <p99> <max> (latencies in usec) */
+static void bench_report(const char*name, double*samples, int n) {
+  double sum=0;
+  int i;
+  for(i=0; i<n; i++)
+    sum+=samples[i];
+  qsort(samples, n, sizeof(*samples), bench_cmp);
+  printf("%-24s %8d %10.3f %12.1f %10.3f %10.3f %10.3f %10.3f\n",
+         name, n, sum*1e-3, (sum>0)?(n*1e6/sum):0,
+         samples[0], sum/n, samples[(int)((n-1)*0.99)], samples[n-1]);
+}
+
+/* a message, pre-parsed so that only the object is benchmarked */
+typedef struct _bench_msg {
+  t_symbol*sel;
+  int argc;
+  t_atom argv[BENCH_MAXARGS];
+} t_bench_msg;
+static void bench_msg(t_bench_msg*msg, const char*sel, const char*args) {
+  msg->sel=gensym(sel);
+  msg->argc=mockpd_atoms(args, msg->argv, BENCH_MAXARGS);
+}
+static void bench_send(t_pd*x, const t_bench_msg*msg) {
+  t_atom argv[BENCH_MAXARGS];
+  /* the classes may modify the atoms */
+  memcpy(argv, msg->argv, msg->argc*sizeof(*argv));
+  mockpd_send(x, msg->sel, msg->argc, argv);
+}
+
+static void bench_driverparse(const char*name, const char*buf, double*samples, int n) {
+  int i;
+  for(i=0; i<n; i++) {
+    t_symkeys drivers;
+    double start=bench_now();
+    symkeys_init(&drivers);
+    apilist_parsedrivers(&drivers, buf);
+    symkeys_free(&drivers);
+    samples[i]=bench_now()-start;
+  }
+  bench_report(name, samples, n);
+}
+/* just the tokenizer */
+static void bench_tokenize(const char*name, const char*buf, double*samples, int n) {
+  int i;
+  for(i=0; i<n; i++) {
+    t_apilist list;
+    t_apispan span;
+    unsigned int count=0;
+    double start=bench_now();
+    apilist_init(&list, buf);
+    while(apilist_next(&list, &span))
+      count+=span.namelen;
+    samples[i]=bench_now()-start;
+    if(!count)
+      fprintf(stderr, "%s: no entries\n", name);
+  }
+  bench_report(name, samples, n);
+}
+
+static void bench_apilist(double*samples, int n, int entries) {
+  char*buf=apilist_gen(entries);
+  char name[64];
+  snprintf(name, sizeof(name), "apilist:tokenize/%d", entries);
+  bench_tokenize(name, buf, samples, n);
+  snprintf(name, sizeof(name), "apilist:drivers/%d", entries);
+  bench_driverparse(name, buf, samples, n);
+  free(buf);
+}
+
+static void bench_new(const char*name, const char*classname, double*samples, int n) {
+  int i;
+  for(i=0; i<n; i++) {
+    double start=bench_now();
+    mockpd_free(mockpd_new(classname));
+    samples[i]=bench_now()-start;
+  }
+  bench_report(name, samples, n);
+}
+
+/* send <msg> <n> times; <reset> (if any) is sent before each (but not timed) */
+static void bench_message(const char*name, t_pd*x, const t_bench_msg*reset,
+                          const t_bench_msg*msg0, const t_bench_msg*msg1,
+                          double*samples, int n) {
+  int i;
+  for(i=0; i<n; i++) {
+    double start;
+    if(reset)
+      bench_send(x, reset);
+    start=bench_now();
+    bench_send(x, (i&1)?msg1:msg0);
+    samples[i]=bench_now()-start;
+  }
+  bench_report(name, samples, n);
+}
+
+static void bench_audio(double*samples, int n, int indevs, int outdevs) {
+  t_pd*x;
+  t_bench_msg refresh, listdevices, stage, discard, params0, params1;
+  char args[MAXPDSTRING];
+
+  sys_get_audio_apis(args);
+  bench_driverparse("audio:driverparse", args, samples, n);
+  bench_new("audio:new", "audiosettings", samples, n);
+
+  x=mockpd_new("audiosettings");
+  bench_msg(&refresh, "refresh", "");
+  bench_msg(&listdevices, "listdevices", "");
+  bench_message("audio:enumerate", x, &refresh, &listdevices, &listdevices, samples, n);
+
+  /* address the devices by name (the last ones, so the lookup has to work for it) */
+  snprintf(args, sizeof(args), "@rate 44100 @blocksize 128 @input mock-audio-in-%03d 2 @output mock-audio-out-%03d 2",
+           indevs-1, outdevs-1);
+  bench_msg(&stage, "stage", args);
+  bench_msg(&discard, "discard", "");
+  bench_message("audio:parse", x, &discard, &stage, &stage, samples, n);
+
+  bench_msg(&params0, "params", "@rate 44100");
+  bench_msg(&params1, "params", "@rate 48000");
+  bench_message("audio:apply", x, 0, &params0, &params1, samples, n);
+
+  mockpd_free(x);
+}
+
+static void bench_midi(double*samples, int n, int indevs, int outdevs) {
+  t_pd*x;
+  t_bench_msg refresh, listdevices, stage, discard, device0, device1;
+  char args[MAXPDSTRING];
+
+  sys_get_midi_apis(args);
+  bench_driverparse("midi:driverparse", args, samples, n);
+  bench_new("midi:new", "midisettings", samples, n);
+
+  x=mockpd_new("midisettings");
+  bench_msg(&refresh, "refresh", "");
+  bench_msg(&listdevices, "listdevices", "");
+  bench_message("midi:enumerate", x, &refresh, &listdevices, &listdevices, samples, n);
+
+  snprintf(args, sizeof(args), "@input mock-midi-in-%03d @output mock-midi-out-%03d",
+           indevs-1, outdevs-1);
+  bench_msg(&stage, "stage", args);
+  bench_msg(&discard, "discard", "");
+  bench_message("midi:parse", x, &discard, &stage, &stage, samples, n);
+
+  /* (MIDI devices are 1-based) */
+  bench_msg(&device0, "device", "@input 1 @output 1");
+  snprintf(args, sizeof(args), "@input %d @output %d", indevs, outdevs);
+  bench_msg(&device1, "device", args);
+  bench_message("midi:apply", x, 0, &device0, &device1, samples, n);
+
+  mockpd_free(x);
+}
+
+static void usage(const char*name) {
+  fprintf(stderr, "usage: %s [-n <iterations>] [-d <drivers>] [-i <indevs>] [-o <outdevs>] [-a <entries>] [-e <usec>] [-v]\n", name);
+  fprintf(stderr, "\t-n: how often each operation is run (default: 1000)\n");
+  fprintf(stderr, "\t-d: number of fake drivers (audio and MIDI, default: 4)\n");
+  fprintf(stderr, "\t-i/-o: number of fake input/output devices (default: 8)\n");
+  fprintf(stderr, "\t-a: number of entries in the generated API lists (default: 10000)\n");
+  fprintf(stderr, "\t-e: simulated duration of a device enumeration (default: 0)\n");
+  fprintf(stderr, "\t-v: print what the classes post\n");
+}
+
+int main(int argc, char**argv) {
+  t_mockpd_config config;
+  double*samples;
+  int n=1000;
+  int entries=10000;
+  int opt;
+
+  memset(&config, 0, sizeof(config));
+  config.audiodrivers=config.mididrivers=4;
+  config.audioindevs=config.audiooutdevs=8;
+  config.midiindevs=config.midioutdevs=8;
+
+  while((opt=getopt(argc, argv, "n:d:i:o:a:e:vh"))!=-1) {
+    switch(opt) {
+    case 'n': n=atoi(optarg); break;
+    case 'd': config.audiodrivers=config.mididrivers=atoi(optarg); break;
+    case 'i': config.audioindevs=config.midiindevs=atoi(optarg); break;
+    case 'o': config.audiooutdevs=config.midioutdevs=atoi(optarg); break;
+    case 'a': entries=atoi(optarg); break;
+    case 'e': config.enumdelay=atoi(optarg); break;
+    case 'v': config.verbose=1; break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if(n<1 || config.audiodrivers<1 || config.audioindevs<1 || config.audiooutdevs<1 || entries<1) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  /* never touch the user's cache */
+  unsetenv("MEDIASETTINGS_CACHE");
+
+  mockpd_init(&config);
+  audiosettings_setup();
+  midisettings_setup();
+
+  samples=(double*)malloc(n*sizeof(*samples));
+  printf("# %d drivers, %d input devices, %d output devices, %d iterations\n",
+         config.audiodrivers, config.audioindevs, config.audiooutdevs, n);
+  printf("%-24s %8s %10s %12s %10s %10s %10s %10s\n",
+         "# benchmark", "n", "total[ms]", "ops/s", "min[us]", "avg[us]", "p99[us]", "max[us]");
+  bench_audio(samples, n, config.audioindevs, config.audiooutdevs);
+  bench_midi (samples, n, config.midiindevs , config.midioutdevs );
+  bench_apilist(samples, n, entries);
+  free(samples);
+
+  printf("# %lu enumerations, %lu applies, %lu dialogs, %lu re-opens, %lu outlet messages, %lu errors\n",
+         mockpd_stats.enumerations, mockpd_stats.applies, mockpd_stats.dialogs,
+         mockpd_stats.reopens, mockpd_stats.outlets, mockpd_stats.errors);
+  return (mockpd_stats.errors>0);
+}
@@ -0,0 +1,665 @@
+/* a mock Pd core for benchmarking [audiosettings]/[midisettings]
+ * (see mockpd.h)
+ *
+ * only what the classes actually use is implemented, and only as far as
+ * the classes need it: no DSP, no GUI, no real files
+ */
+#define PD_CLASS_DEF /* we implement class_addbang() & co */
+#include "mockpd.h"
+#include "s_stuff.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/* first driver id of the fake backends (well away from Pd's API_* ids) */
+#define MOCKPD_AUDIOAPI 100
+#define MOCKPD_MIDIAPI  200
+/* the number of device slots in the 'audio-dialog'/'midi-dialog' messages */
+#define MOCKPD_DIALOG_NDEV 4
+
+t_mockpd_stats mockpd_stats;
+static t_mockpd_config CONFIG = {1, 1, 1,  1, 1, 1,  0, 0};
+
+/* ------------------------- memory ------------------------- */
+void *getbytes(size_t nbytes) {
+  void*ret=calloc(1, nbytes?nbytes:1);
+  if(!ret) {
+    fprintf(stderr, "mockpd: out of memory (%lu bytes)\n", (unsigned long)nbytes);
+    abort();
+  }
+  return ret;
+}
+void *resizebytes(void *x, size_t oldsize, size_t newsize) {
+  char*ret=(char*)realloc(x, newsize?newsize:1);
+  if(!ret) {
+    fprintf(stderr, "mockpd: out of memory (%lu bytes)\n", (unsigned long)newsize);
+    abort();
+  }
+  if(newsize>oldsize)
+    memset(ret+oldsize, 0, newsize-oldsize);
+  return ret;
+}
+void freebytes(void *x, size_t nbytes) {
+  (void)nbytes;
+  free(x);
+}
+
+/* ------------------------- printing ------------------------- */
+t_printhook sys_printhook = 0;
+static char postbuf[MAXPDSTRING];
+
+static void mockpd_print(const char*s) {
+  if(sys_printhook)
+    sys_printhook(s);
+  else if(CONFIG.verbose)
+    fputs(s, stderr);
+}
+static void mockpd_vpost(const char*prefix, const char*fmt, va_list ap) {
+  char buf[MAXPDSTRING];
+  size_t len=strlen(prefix);
+  snprintf(buf, sizeof(buf), "%s", prefix);
+  vsnprintf(buf+len, sizeof(buf)-len-1, fmt, ap);
+  strcat(buf, "\n");
+  mockpd_print(buf);
+}
+void post(const char *fmt, ...) {
+  va_list ap;
+  mockpd_stats.posts++;
+  va_start(ap, fmt);
+  mockpd_vpost("", fmt, ap);
+  va_end(ap);
+}
+void verbose(int level, const char *fmt, ...) {
+  va_list ap;
+  (void)level;
+  mockpd_stats.posts++;
+  va_start(ap, fmt);
+  mockpd_vpost("verbose: ", fmt, ap);
+  va_end(ap);
+}
+void pd_error(const void *object, const char *fmt, ...) {
+  va_list ap;
+  (void)object;
+  mockpd_stats.errors++;
+  va_start(ap, fmt);
+  mockpd_vpost("error: ", fmt, ap);
+  va_end(ap);
+}
+void startpost(const char *fmt, ...) {
+  va_list ap;
+  size_t len=strlen(postbuf);
+  va_start(ap, fmt);
+  vsnprintf(postbuf+len, sizeof(postbuf)-len, fmt, ap);
+  va_end(ap);
+}
+void poststring(const char *s) {
+  startpost(" %s", s);
+}
+void postatom(int argc, const t_atom *argv) {
+  int i;
+  for(i=0; i<argc; i++) {
+    if(A_FLOAT==argv[i].a_type)
+      startpost(" %g", argv[i].a_w.w_float);
+    else if(A_SYMBOL==argv[i].a_type)
+      startpost(" %s", argv[i].a_w.w_symbol->s_name);
+  }
+}
+void endpost(void) {
+  mockpd_stats.posts++;
+  if(*postbuf) {
+    startpost("\n");
+    mockpd_print(postbuf);
+  }
+  *postbuf=0;
+}
+
+/* ------------------------- symbols & atoms ------------------------- */
+#define MOCKPD_HASHSIZE 1024
+static t_symbol*symhash[MOCKPD_HASHSIZE];
+
+t_symbol *gensym(const char *s) {
+  unsigned int hash=5381;
+  const char*c;
+  t_symbol*sym;
+  for(c=s; *c; c++)
+    hash=hash*33 + (unsigned char)*c;
+  hash%=MOCKPD_HASHSIZE;
+  for(sym=symhash[hash]; sym; sym=sym->s_next) {
+    if(!strcmp(sym->s_name, s))
+      return sym;
+  }
+  sym=(t_symbol*)getbytes(sizeof(*sym));
+  sym->s_name=strdup(s);
+  sym->s_next=symhash[hash];
+  symhash[hash]=sym;
+  return sym;
+}
+
+t_float atom_getfloat(const t_atom *a) {
+  return (A_FLOAT==a->a_type)?a->a_w.w_float:0;
+}
+t_int atom_getint(const t_atom *a) {
+  return (t_int)atom_getfloat(a);
+}
+t_symbol *atom_getsymbol(const t_atom *a) {
+  return (A_SYMBOL==a->a_type)?a->a_w.w_symbol:gensym("");
+}
+t_float atom_getfloatarg(int which, int argc, const t_atom *argv) {
+  return (which<argc)?atom_getfloat(argv+which):0;
+}
+t_int atom_getintarg(int which, int argc, const t_atom *argv) {
+  return (t_int)atom_getfloatarg(which, argc, argv);
+}
+t_symbol *atom_getsymbolarg(int which, int argc, const t_atom *argv) {
+  return (which<argc)?atom_getsymbol(argv+which):gensym("");
+}
+
+int mockpd_atoms(const char*args, t_atom*argv, int maxargc) {
+  int argc=0;
+  while(*args && argc<maxargc) {
+    char word[MAXPDSTRING];
+    char*end;
+    double f;
+    size_t len=strcspn(args, " \t\n");
+    if(!len) {
+      args++;
+      continue;
+    }
+    if(len>=sizeof(word))
+      len=sizeof(word)-1;
+    memcpy(word, args, len);
+    word[len]=0;
+    args+=len;
+    f=strtod(word, &end);
+    if(!*end) {
+      SETFLOAT(argv+argc, (t_float)f);
+    } else {
+      SETSYMBOL(argv+argc, gensym(word));
+    }
+    argc++;
+  }
+  return argc;
+}
+
+/* ------------------------- classes & objects ------------------------- */
+#define MOCKPD_MAXMETHODS 64
+typedef struct _mockpd_method {
+  t_symbol*sel;
+  t_method fn;
+  t_atomtype argtype; /* only single-argument methods are supported */
+} t_mockpd_method;
+struct _class {
+  t_symbol*name;
+  t_newmethod newfn;
+  t_method freefn;
+  size_t size;
+  t_method bangfn;
+  t_mockpd_method methods[MOCKPD_MAXMETHODS];
+  int nmethods;
+  struct _class*next;
+};
+static t_class*classes=0;
+
+struct _outlet {
+  t_object*owner;
+  struct _outlet*next;
+};
+static t_outlet*outlets=0;
+
+t_class *class_new(t_symbol *name, t_newmethod newmethod, t_method freemethod,
+                   size_t size, int flags, t_atomtype arg1, ...) {
+  t_class*c=(t_class*)getbytes(sizeof(*c));
+  (void)flags; (void)arg1;
+  c->name=name;
+  c->newfn=newmethod;
+  c->freefn=freemethod;
+  c->size=size;
+  c->next=classes;
+  classes=c;
+  return c;
+}
+void (class_addmethod)(t_class *c, t_method fn, t_symbol *sel, t_atomtype arg1, ...) {
+  if(c->nmethods>=MOCKPD_MAXMETHODS) {
+    fprintf(stderr, "mockpd: too many methods for [%s]\n", c->name->s_name);
+    return;
+  }
+  c->methods[c->nmethods].sel=sel;
+  c->methods[c->nmethods].fn=fn;
+  c->methods[c->nmethods].argtype=arg1;
+  c->nmethods++;
+}
+void (class_addbang)(t_class *c, t_method fn) {
+  c->bangfn=fn;
+}
+
+t_pd *pd_new(t_class *c) {
+  t_pd*x=(t_pd*)getbytes(c->size);
+  *x=c;
+  return x;
+}
+
+t_outlet *outlet_new(t_object *owner, t_symbol *s) {
+  t_outlet*o=(t_outlet*)getbytes(sizeof(*o));
+  (void)s;
+  o->owner=owner;
+  o->next=outlets;
+  outlets=o;
+  return o;
+}
+void outlet_anything(t_outlet *x, t_symbol *s, int argc, t_atom *argv) {
+  (void)x; (void)s; (void)argc; (void)argv;
+  mockpd_stats.outlets++;
+}
+
+t_pd*mockpd_new(const char*classname) {
+  t_symbol*name=gensym(classname);
+  t_class*c;
+  for(c=classes; c; c=c->next) {
+    if(name == c->name)
+      return (t_pd*)c->newfn();
+  }
+  fprintf(stderr, "mockpd: no class [%s]\n", classname);
+  return 0;
+}
+void mockpd_free(t_pd*x) {
+  t_outlet**o=&outlets;
+  if((*x)->freefn)
+    ((void(*)(t_pd*))(*x)->freefn)(x);
+  while(*o) {
+    if((t_pd*)((*o)->owner) == x) {
+      t_outlet*dead=*o;
+      *o=dead->next;
+      freebytes(dead, sizeof(*dead));
+    } else
+      o=&(*o)->next;
+  }
+  freebytes(x, (*x)->size);
+}
+
+/* ------------------------- the 'pd' receiver ------------------------- */
+static t_class pdclass;
+static t_pd pdobject=&pdclass;
+
+static t_audiosettings AUDIO;
+static int audioopen=1;
+static int midiin[MAXMIDIINDEV], midiout[MAXMIDIOUTDEV];
+static int nmidiin=1, nmidiout=1;
+int sys_audioapi=MOCKPD_AUDIOAPI;
+int sys_midiapi=MOCKPD_MIDIAPI;
+
+static void pd_audiodialog(int argc, t_atom*argv) {
+  int i;
+  if(argc<4*MOCKPD_DIALOG_NDEV+4)
+    return;
+  AUDIO.a_nindev=AUDIO.a_noutdev=0;
+  for(i=0; i<MOCKPD_DIALOG_NDEV; i++) {
+    int ch=(int)atom_getfloat(argv+i+1*MOCKPD_DIALOG_NDEV);
+    if(ch>0) {
+      AUDIO.a_indevvec  [AUDIO.a_nindev]=(int)atom_getfloat(argv+i);
+      AUDIO.a_chindevvec[AUDIO.a_nindev]=ch;
+      AUDIO.a_nindev++;
+    }
+    ch=(int)atom_getfloat(argv+i+3*MOCKPD_DIALOG_NDEV);
+    if(ch>0) {
+      AUDIO.a_outdevvec  [AUDIO.a_noutdev]=(int)atom_getfloat(argv+i+2*MOCKPD_DIALOG_NDEV);
+      AUDIO.a_choutdevvec[AUDIO.a_noutdev]=ch;
+      AUDIO.a_noutdev++;
+    }
+  }
+  AUDIO.a_nchindev=AUDIO.a_nindev;
+  AUDIO.a_nchoutdev=AUDIO.a_noutdev;
+  argv+=4*MOCKPD_DIALOG_NDEV;
+  AUDIO.a_srate    =(int)atom_getfloat(argv+0);
+  AUDIO.a_advance  =(int)atom_getfloat(argv+1);
+  AUDIO.a_callback =(int)atom_getfloat(argv+2);
+  AUDIO.a_blocksize=(int)atom_getfloat(argv+3);
+  mockpd_stats.reopens++;
+}
+/* MIDI devices are 1-based (0=none) in the dialog */
+static void pd_mididialog(int argc, t_atom*argv) {
+  int i;
+  if(argc<2*MOCKPD_DIALOG_NDEV)
+    return;
+  nmidiin=nmidiout=0;
+  for(i=0; i<MOCKPD_DIALOG_NDEV; i++) {
+    int dev=(int)atom_getfloat(argv+i);
+    if(dev>0)
+      midiin[nmidiin++]=dev-1;
+    dev=(int)atom_getfloat(argv+i+MOCKPD_DIALOG_NDEV);
+    if(dev>0)
+      midiout[nmidiout++]=dev-1;
+  }
+  mockpd_stats.reopens++;
+}
+
+/* ------------------------- message passing ------------------------- */
+typedef void (*t_mockpd_nullfn)(t_pd*x);
+typedef void (*t_mockpd_floatfn)(t_pd*x, t_floatarg f);
+typedef void (*t_mockpd_symbolfn)(t_pd*x, t_symbol*s);
+typedef void (*t_mockpd_gimmefn)(t_pd*x, t_symbol*s, int argc, t_atom*argv);
+
+void typedmess(t_pd *x, t_symbol *s, int argc, t_atom *argv) {
+  t_class*c=*x;
+  int i;
+  if(&pdclass == c) {
+    mockpd_stats.dialogs++;
+    if(gensym("audio-dialog") == s)
+      pd_audiodialog(argc, argv);
+    else if(gensym("midi-dialog") == s)
+      pd_mididialog(argc, argv);
+    return;
+  }
+  if(gensym("bang") == s && c->bangfn) {
+    ((t_mockpd_nullfn)c->bangfn)(x);
+    return;
+  }
+  for(i=0; i<c->nmethods; i++) {
+    const t_mockpd_method*m=c->methods+i;
+    if(s != m->sel)
+      continue;
+    switch(m->argtype) {
+    case A_NULL:
+      ((t_mockpd_nullfn)m->fn)(x);
+      break;
+    case A_FLOAT:
+      ((t_mockpd_floatfn)m->fn)(x, atom_getfloatarg(0, argc, argv));
+      break;
+    case A_SYMBOL:
+      ((t_mockpd_symbolfn)m->fn)(x, atom_getsymbolarg(0, argc, argv));
+      break;
+    case A_GIMME:
+      ((t_mockpd_gimmefn)m->fn)(x, s, argc, argv);
+      break;
+    default:
+      fprintf(stderr, "mockpd: unsupported method signature for '%s'\n", s->s_name);
+      break;
+    }
+    return;
+  }
+  pd_error(x, "%s: no method for '%s'", c->name->s_name, s->s_name);
+}
+void pd_typedmess(t_pd *x, t_symbol *s, int argc, t_atom *argv) {
+  typedmess(x, s, argc, argv);
+}
+void mockpd_send(t_pd*x, t_symbol*s, int argc, t_atom*argv) {
+  typedmess(x, s, argc, argv);
+}
+
+/* ------------------------- time & clocks ------------------------- */
+/* the logical time is in msec */
+static double logicaltime=0;
+struct _clock {
+  void*owner;
+  t_method fn;
+  double settime;
+  int set;
+  struct _clock*next;
+};
+static t_clock*clocks=0;
+
+t_clock *clock_new(void *owner, t_method fn) {
+  t_clock*x=(t_clock*)getbytes(sizeof(*x));
+  x->owner=owner;
+  x->fn=fn;
+  x->next=clocks;
+  clocks=x;
+  return x;
+}
+void clock_free(t_clock *x) {
+  t_clock**c;
+  if(!x)
+    return;
+  for(c=&clocks; *c; c=&(*c)->next) {
+    if(x == *c) {
+      *c=x->next;
+      break;
+    }
+  }
+  freebytes(x, sizeof(*x));
+}
+void clock_set(t_clock *x, double settime) {
+  x->settime=settime;
+  x->set=1;
+}
+void clock_delay(t_clock *x, double delaytime) {
+  clock_set(x, logicaltime + ((delaytime>0)?delaytime:0));
+}
+void clock_unset(t_clock *x) {
+  x->set=0;
+}
+double clock_getlogicaltime(void) {
+  return logicaltime;
+}
+double clock_getsystime(void) {
+  return logicaltime;
+}
+double clock_gettimesince(double prevsystime) {
+  return logicaltime - prevsystime;
+}
+
+void mockpd_advance(double msec) {
+  double target=logicaltime+msec;
+  for(;;) {
+    t_clock*next=0, *c;
+    for(c=clocks; c; c=c->next) {
+      if(c->set && c->settime<=target && (!next || c->settime<next->settime))
+        next=c;
+    }
+    if(!next)
+      break;
+    logicaltime=next->settime;
+    next->set=0;
+    ((void(*)(void*))next->fn)(next->owner);
+  }
+  logicaltime=target;
+}
+
+double sys_getrealtime(void) {
+  static struct timespec start;
+  struct timespec now;
+  if(!start.tv_sec && !start.tv_nsec)
+    clock_gettime(CLOCK_MONOTONIC, &start);
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec-start.tv_sec) + (now.tv_nsec-start.tv_nsec)*1e-9;
+}
+
+static pthread_mutex_t pdlock=PTHREAD_MUTEX_INITIALIZER;
+void sys_lock(void) {
+  pthread_mutex_lock(&pdlock);
+}
+void sys_unlock(void) {
+  pthread_mutex_unlock(&pdlock);
+}
+
+/* ------------------------- binbufs ------------------------- */
+/* in memory only: reading/writing files always fails */
+struct _binbuf {
+  int n;
+  t_atom*vec;
+};
+t_binbuf *binbuf_new(void) {
+  return (t_binbuf*)getbytes(sizeof(t_binbuf));
+}
+void binbuf_free(t_binbuf *x) {
+  freebytes(x->vec, x->n*sizeof(*x->vec));
+  freebytes(x, sizeof(*x));
+}
+static t_atom*binbuf_grow(t_binbuf*x) {
+  x->vec=(t_atom*)resizebytes(x->vec, x->n*sizeof(*x->vec), (x->n+1)*sizeof(*x->vec));
+  return x->vec + x->n++;
+}
+void binbuf_addv(t_binbuf *x, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  for(; *fmt; fmt++) {
+    t_atom*a;
+    switch(*fmt) {
+    case 'f': a=binbuf_grow(x); SETFLOAT (a, (t_float)va_arg(ap, double)); break;
+    case 'i': a=binbuf_grow(x); SETFLOAT (a, (t_float)va_arg(ap, int)); break;
+    case 's': a=binbuf_grow(x); SETSYMBOL(a, va_arg(ap, t_symbol*)); break;
+    case ';': a=binbuf_grow(x); a->a_type=A_SEMI; a->a_w.w_index=0; break;
+    default: break;
+    }
+  }
+  va_end(ap);
+}
+void binbuf_addsemi(t_binbuf *x) {
+  binbuf_addv(x, ";");
+}
+int binbuf_getnatom(const t_binbuf *x) {
+  return x->n;
+}
+t_atom *binbuf_getvec(const t_binbuf *x) {
+  return x->vec;
+}
+int binbuf_read(t_binbuf *b, const char *filename, const char *dirname, int crflag) {
+  (void)b; (void)filename; (void)dirname; (void)crflag;
+  return 1;
+}
+int binbuf_write(const t_binbuf *x, const char *filename, const char *dir, int crflag) {
+  (void)x; (void)filename; (void)dir; (void)crflag;
+  return 1;
+}
+
+/* ------------------------- misc ------------------------- */
+t_canvas *canvas_getcurrent(void) {
+  return 0;
+}
+t_symbol *canvas_getdir(const t_glist *x) {
+  (void)x;
+  return gensym(".");
+}
+int sys_isabsolutepath(const char *dir) {
+  return ('/' == *dir);
+}
+void sys_getversion(int *major, int *minor, int *bugfix) {
+  if(major) *major=PD_MAJOR_VERSION;
+  if(minor) *minor=PD_MINOR_VERSION;
+  if(bugfix) *bugfix=0;
+}
+int pd_getdspstate(void) {
+  return 1;
+}
+
+/* ------------------------- the fake backend ------------------------- */
+/* '{ {<name> <id>} ... }' as Pd does it */
+static void mockpd_apis(char*buf, const char*prefix, int count, int firstid) {
+  size_t len;
+  int i;
+  strcpy(buf, "{ ");
+  len=strlen(buf);
+  for(i=0; i<count; i++) {
+    char entry[64];
+    int n=snprintf(entry, sizeof(entry), "{%s%d %d} ", prefix, i, firstid+i);
+    if(len + n + 2 > MAXPDSTRING)
+      break;
+    strcpy(buf+len, entry);
+    len+=n;
+  }
+  strcpy(buf+len, "}");
+}
+static void mockpd_devs(char*list, int*ndevs, int count, const char*prefix,
+                        int maxndev, int devdescsize) {
+  int i;
+  if(count>maxndev)
+    count=maxndev;
+  for(i=0; i<count; i++)
+    snprintf(list+i*devdescsize, devdescsize, "%s-%03d", prefix, i);
+  *ndevs=count;
+}
+static void mockpd_enumerate(void) {
+  mockpd_stats.enumerations++;
+  if(CONFIG.enumdelay>0)
+    usleep(CONFIG.enumdelay);
+}
+
+void sys_get_audio_apis(char *buf) {
+  mockpd_apis(buf, "mockaudio", CONFIG.audiodrivers, MOCKPD_AUDIOAPI);
+}
+void sys_get_audio_devs(char *indevlist, int *nindevs,
+                        char *outdevlist, int *noutdevs,
+                        int *canmulti, int *cancallback,
+                        int maxndev, int devdescsize, int api) {
+  (void)api;
+  mockpd_enumerate();
+  mockpd_devs(indevlist , nindevs , CONFIG.audioindevs , "mock-audio-in" , maxndev, devdescsize);
+  mockpd_devs(outdevlist, noutdevs, CONFIG.audiooutdevs, "mock-audio-out", maxndev, devdescsize);
+  *canmulti=1;
+  *cancallback=1;
+}
+void sys_get_audio_settings(t_audiosettings *a) {
+  *a=AUDIO;
+}
+void sys_set_audio_settings(t_audiosettings *a) {
+  mockpd_stats.applies++;
+  AUDIO=*a;
+}
+void sys_close_audio(void) {
+  audioopen=0;
+}
+void sys_reopen_audio(void) {
+  mockpd_stats.reopens++;
+  audioopen=1;
+}
+int audio_isopen(void) {
+  return audioopen;
+}
+
+void sys_get_midi_apis(char *buf) {
+  mockpd_apis(buf, "mockmidi", CONFIG.mididrivers, MOCKPD_MIDIAPI);
+}
+void sys_get_midi_devs(char *indevlist, int *nindevs,
+                       char *outdevlist, int *noutdevs,
+                       int maxndev, int devdescsize) {
+  mockpd_enumerate();
+  mockpd_devs(indevlist , nindevs , CONFIG.midiindevs , "mock-midi-in" , maxndev, devdescsize);
+  mockpd_devs(outdevlist, noutdevs, CONFIG.midioutdevs, "mock-midi-out", maxndev, devdescsize);
+}
+void sys_get_midi_params(int *pnmidiindev, int *pmidiindev,
+                         int *pnmidioutdev, int *pmidioutdev) {
+  int i;
+  *pnmidiindev=nmidiin;
+  for(i=0; i<nmidiin; i++)
+    pmidiindev[i]=midiin[i];
+  *pnmidioutdev=nmidiout;
+  for(i=0; i<nmidiout; i++)
+    pmidioutdev[i]=midiout[i];
+}
+void sys_set_midi_api(int api) {
+  sys_midiapi=api;
+}
+void sys_close_midi(void) {
+}
+void sys_reopen_midi(void) {
+  mockpd_stats.reopens++;
+}
+
+/* ------------------------- setup ------------------------- */
+void mockpd_init(const t_mockpd_config*config) {
+  if(config)
+    CONFIG=*config;
+  memset(&mockpd_stats, 0, sizeof(mockpd_stats));
+
+  pdclass.name=gensym("pd");
+  gensym("pd")->s_thing=&pdobject;
+
+  memset(&AUDIO, 0, sizeof(AUDIO));
+  AUDIO.a_api=sys_audioapi;
+  AUDIO.a_nindev=AUDIO.a_nchindev=1;
+  AUDIO.a_chindevvec[0]=2;
+  AUDIO.a_noutdev=AUDIO.a_nchoutdev=1;
+  AUDIO.a_choutdevvec[0]=2;
+  AUDIO.a_srate=48000;
+  AUDIO.a_advance=25;
+  AUDIO.a_callback=0;
+  AUDIO.a_blocksize=DEFDACBLKSIZE;
+  audioopen=1;
+
+  nmidiin=nmidiout=1;
+  midiin[0]=midiout[0]=0;
+}
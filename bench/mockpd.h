@@ -0,0 +1,46 @@
+/* a mock Pd core for benchmarking [audiosettings]/[midisettings]
+ * outside of Pd (and without any audio/MIDI hardware)
+ *
+ * it implements just enough of Pd's API to instantiate the classes, send
+ * them messages and run their clocks; the backend (drivers, devices and
+ * settings) is faked with a configurable number of drivers and devices
+ */
+#ifndef MOCKPD_H
+#define MOCKPD_H
+
+#include "m_pd.h"
+
+typedef struct _mockpd_config {
+  int audiodrivers, audioindevs, audiooutdevs;
+  int mididrivers, midiindevs, midioutdevs;
+  int enumdelay; /* usec per device enumeration (to emulate slow backends) */
+  int verbose;   /* print what the classes post */
+} t_mockpd_config;
+
+/* what the classes did to the (fake) core */
+typedef struct _mockpd_stats {
+  unsigned long posts, errors;
+  unsigned long outlets;      /* messages sent to outlets */
+  unsigned long enumerations; /* sys_get_*_devs() */
+  unsigned long dialogs;      /* 'pd audio-dialog'/'pd midi-dialog' */
+  unsigned long applies;      /* sys_set_audio_settings() */
+  unsigned long reopens;      /* sys_reopen_*() */
+} t_mockpd_stats;
+extern t_mockpd_stats mockpd_stats;
+
+/* (re)configures the fake backend; call before loading the classes */
+void mockpd_init(const t_mockpd_config*config);
+
+/* create/destroy an object of a loaded class (by name) */
+t_pd*mockpd_new(const char*classname);
+void mockpd_free(t_pd*x);
+
+/* parse <args> (whitespace separated) into atoms; returns the number of atoms */
+int mockpd_atoms(const char*args, t_atom*argv, int maxargc);
+/* send a message to an object (as if it came from its inlet) */
+void mockpd_send(t_pd*x, t_symbol*s, int argc, t_atom*argv);
+
+/* advance the logical time by <msec>, running all clocks that are due */
+void mockpd_advance(double msec);
+
+#endif /* MOCKPD_H */
@@ -18,89 +18,1420 @@
 #include "s_stuff.h"
 #include <stdio.h>
 #include <string.h>
+#include <stddef.h>
+#include <stdlib.h>
 #include <ctype.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
 
-#define MAXNDEV 20
-#define DEVDESCSIZE 80
+#ifdef __linux__
+# include <sys/inotify.h>
+# include <poll.h>
+# include <unistd.h>
+# include <errno.h>
+#endif
+
+/* initial size of the enumeration buffers (they grow as needed) */
+#define DEVPROBE_NDEV 32
+#define DEVPROBE_DESCSIZE 128
+/* stop growing if the backend keeps filling whatever we give it */
+#define DEVPROBE_MAXNDEV 4096
+#define DEVPROBE_MAXDESCSIZE 4096
 
 #ifndef BUILD_DATE
 # define BUILD_DATE "on " __DATE__ " at " __TIME__
 #endif
 
 /**
- * find EOS of a string of tokens
- * where EOS might be indicated by \0, }
+ * apilist: a tokenizer for the Tcl-style lists Pd uses to report its APIs,
+ * e.g. '{ {ALSA 1} {"JACK" 5} {{dummy audio} 9} }'
+ *
+ * entries are '{<name> <id>}', where the name is a bare word, a "quoted"
+ * or a {braced} string (possibly with \-escapes); the (optional) outer
+ * braces are the list itself
+ * this is a single pass over the string, returning spans into it (no copies);
+ * malformed entries are skipped
+ */
+typedef struct _apispan {
+  const char*name;     /* not 0-terminated */
+  size_t namelen;
+  int escaped;         /* the name contains \-escapes */
+  int id;
+} t_apispan;
+
+typedef struct _apilist {
+  const char*pos;
+  unsigned int skipped; /* malformed entries */
+} t_apilist;
+
+static const char*apilist_skipspace(const char*s) {
+  while(isspace((unsigned char)*s))
+    s++;
+  return s;
+}
+
+/* reads a word at the current level (stops at the closing '}' without consuming it)
+ * returns 0 if there are no more words */
+static int apilist_word(const char**pos, const char**word, size_t*len, int*escaped) {
+  const char*s=apilist_skipspace(*pos);
+  const char*start;
+  *escaped=0;
+  switch(*s) {
+  case '\0': case '}':
+    *pos=s;
+    return 0;
+  case '{': {
+    unsigned int depth=1;
+    start=++s;
+    for(; *s; s++) {
+      if('\\'==*s && s[1]) {
+        *escaped=1;
+        s++;
+      } else if('{'==*s) {
+        depth++;
+      } else if('}'==*s && !--depth) {
+        break;
+      }
+    }
+    *word=start;
+    *len=s-start;
+    *pos=(*s)?s+1:s;
+    return 1;
+  }
+  case '"':
+    start=++s;
+    for(; *s && '"'!=*s; s++) {
+      if('\\'==*s && s[1]) {
+        *escaped=1;
+        s++;
+      }
+    }
+    *word=start;
+    *len=s-start;
+    *pos=(*s)?s+1:s;
+    return 1;
+  default:
+    start=s;
+    for(; *s && !isspace((unsigned char)*s) && '}'!=*s && '{'!=*s; s++) {
+      if('\\'==*s && s[1]) {
+        *escaped=1;
+        s++;
+      }
+    }
+    *word=start;
+    *len=s-start;
+    *pos=s;
+    return 1;
+  }
+}
+
+/* an integer that spans the entire word */
+static int apilist_id(const char*word, const size_t len, int*id) {
+  size_t i=0;
+  long v=0;
+  int sign=1;
+  if(len && '-'==word[0]) {
+    sign=-1;
+    i++;
+  }
+  if(i>=len || len-i>9)
+    return 0;
+  for(; i<len; i++) {
+    if(word[i]<'0' || word[i]>'9')
+      return 0;
+    v=v*10+(word[i]-'0');
+  }
+  *id=(int)(sign*v);
+  return 1;
+}
+
+static void apilist_init(t_apilist*list, const char*buf) {
+  const char*s=apilist_skipspace(buf);
+  list->skipped=0;
+  /* '{ {...} ...}' resp. '{}': skip the outer brace */
+  if('{'==*s) {
+    const char*s1=apilist_skipspace(s+1);
+    if('{'==*s1 || '}'==*s1)
+      s=s1;
+  }
+  list->pos=s;
+}
+
+/* the next '{<name> <id>}' entry; returns 0 at the end of the list */
+static int apilist_next(t_apilist*list, t_apispan*span) {
+  for(;;) {
+    const char*s=apilist_skipspace(list->pos);
+    const char*word;
+    size_t len;
+    int escaped, ok;
+    if('{'!=*s) {
+      /* end of the list; or a stray word (which we skip) */
+      if(!apilist_word(&s, &word, &len, &escaped)) {
+        list->pos=s;
+        return 0;
+      }
+      list->pos=s;
+      list->skipped++;
+      continue;
+    }
+    s++;
+    ok=apilist_word(&s, &span->name, &span->namelen, &span->escaped)
+      && apilist_word(&s, &word, &len, &escaped)
+      && apilist_id(word, len, &span->id);
+    /* anything else in the entry makes it malformed */
+    while(apilist_word(&s, &word, &len, &escaped))
+      ok=0;
+    list->pos=(*s)?s+1:s;
+    if(ok)
+      return 1;
+    list->skipped++;
+  }
+}
+
+/* the (unescaped) name of <span> as a 0-terminated string (truncated to <size>) */
+static void apispan_getname(const t_apispan*span, char*buf, size_t size) {
+  size_t i, n=0;
+  if(!size)
+    return;
+  if(!span->escaped) {
+    n=(span->namelen<size)?span->namelen:size-1;
+    memcpy(buf, span->name, n);
+  } else {
+    for(i=0; i<span->namelen && n<size-1; i++) {
+      if('\\'==span->name[i] && i+1<span->namelen)
+        i++;
+      buf[n++]=span->name[i];
+    }
+  }
+  buf[n]=0;
+}
+
+/**
+ * symkeys: a registry that maps symbols to numeric ids (and back)
+ *
+ * entries are kept in insertion order (for listing them),
+ * two open-addressing hashtables index them by name and by id
+ */
+typedef struct _symkey {
+  t_symbol*name;
+  int      id;
+} t_symkey;
+
+typedef struct _symkeys {
+  t_symkey*entries;
+  unsigned int count, size;   /* used/allocated entries */
+
+  unsigned int*byname;        /* slots hold (index+1) into entries, 0=empty */
+  unsigned int*byid;
+  unsigned int hashsize;      /* power of two, always >2*size */
+} t_symkeys;
+
+static unsigned int symkeys_hashname(const t_symbol*name) {
+  /* symbols are unique, so we can just hash the pointer */
+  size_t v=(size_t)name;
+  v^=(v>>4)^(v>>16);
+  return (unsigned int)v*2654435761u;
+}
+static unsigned int symkeys_hashid(const int id) {
+  unsigned int v=(unsigned int)id*2654435761u;
+  return v^(v>>16);
+}
+
+static void symkeys_init(t_symkeys*keys) {
+  memset(keys, 0, sizeof(*keys));
+}
+
+/* forget all entries, but keep the memory for re-use */
+static void symkeys_clear(t_symkeys*keys) {
+  keys->count=0;
+  if(keys->hashsize) {
+    memset(keys->byname, 0, keys->hashsize*sizeof(*keys->byname));
+    memset(keys->byid  , 0, keys->hashsize*sizeof(*keys->byid  ));
+  }
+}
+
+static void symkeys_free(t_symkeys*keys) {
+  if(keys->entries)
+    freebytes(keys->entries, keys->size*sizeof(*keys->entries));
+  if(keys->byname)
+    freebytes(keys->byname, keys->hashsize*sizeof(*keys->byname));
+  if(keys->byid)
+    freebytes(keys->byid  , keys->hashsize*sizeof(*keys->byid  ));
+  symkeys_init(keys);
+}
+
+static t_symkey*symkeys_find(const t_symkeys*keys, const t_symbol*name) {
+  unsigned int mask=keys->hashsize-1, h, idx;
+  if(!keys->hashsize)return NULL;
+  for(h=symkeys_hashname(name)&mask; (idx=keys->byname[h]); h=(h+1)&mask) {
+    if(name==keys->entries[idx-1].name)
+      return keys->entries+idx-1;
+  }
+  return NULL;
+}
+
+static t_symkey*symkeys_findid(const t_symkeys*keys, const int id) {
+  unsigned int mask=keys->hashsize-1, h, idx;
+  if(!keys->hashsize)return NULL;
+  for(h=symkeys_hashid(id)&mask; (idx=keys->byid[h]); h=(h+1)&mask) {
+    if(id==keys->entries[idx-1].id)
+      return keys->entries+idx-1;
+  }
+  return NULL;
+}
+
+/* put entry #index into the hashtables (first come, first served) */
+static void symkeys_index(t_symkeys*keys, unsigned int index) {
+  const t_symkey*entry=keys->entries+index;
+  unsigned int mask=keys->hashsize-1, h;
+
+  for(h=symkeys_hashname(entry->name)&mask; keys->byname[h]; h=(h+1)&mask) {
+    if(entry->name==keys->entries[keys->byname[h]-1].name)break;
+  }
+  if(!keys->byname[h])keys->byname[h]=index+1;
+
+  for(h=symkeys_hashid(entry->id)&mask; keys->byid[h]; h=(h+1)&mask) {
+    if(entry->id==keys->entries[keys->byid[h]-1].id)break;
+  }
+  if(!keys->byid[h])keys->byid[h]=index+1;
+}
+
+static void symkeys_grow(t_symkeys*keys) {
+  unsigned int size=keys->size?(keys->size*2):8;
+  unsigned int hashsize=size*4;
+  unsigned int i;
+
+  keys->entries=(t_symkey*)resizebytes(keys->entries,
+                                      keys->size*sizeof(*keys->entries),
+                                      size*sizeof(*keys->entries));
+  if(keys->byname)
+    freebytes(keys->byname, keys->hashsize*sizeof(*keys->byname));
+  if(keys->byid)
+    freebytes(keys->byid  , keys->hashsize*sizeof(*keys->byid  ));
+  keys->byname=(unsigned int*)getbytes(hashsize*sizeof(*keys->byname));
+  keys->byid  =(unsigned int*)getbytes(hashsize*sizeof(*keys->byid  ));
+  keys->size=size;
+  keys->hashsize=hashsize;
+
+  for(i=0; i<keys->count; i++)
+    symkeys_index(keys, i);
+}
+
+/**
+ * add a new name/id pair
+ * if the name is already taken, the existing entry is returned,
+ * unless 'uniquify' is set, in which case the new entry is stored as 'name[id]'
+ */
+static t_symkey*symkeys_add(t_symkeys*keys, t_symbol*name, int id, int uniquify) {
+  t_symkey*symkey=symkeys_find(keys, name);
+
+  if(symkey) {
+    char buf[MAXPDSTRING+1];
+    buf[MAXPDSTRING]=0;
+
+    if(!uniquify)
+      return symkey;
+    snprintf(buf, MAXPDSTRING, "%s[%d]", name->s_name, id);
+    return symkeys_add(keys, gensym(buf), id, uniquify);
+  }
+
+  if(keys->count>=keys->size)
+    symkeys_grow(keys);
+
+  symkey=keys->entries+keys->count;
+  symkey->name=name;
+  symkey->id=id;
+  symkeys_index(keys, keys->count);
+  keys->count++;
+
+  return symkey;
+}
+
+static t_symbol*symkeys_getname(const t_symkeys*keys, const int id) {
+  t_symkey*symkey=symkeys_findid(keys, id);
+  if(symkey)
+    return symkey->name;
+  return NULL;
+}
+static int symkeys_getid(const t_symkeys*keys, const t_symbol*name) {
+  t_symkey*symkey=symkeys_find(keys, name);
+  if(symkey)
+    return symkey->id;
+  return -1; /* unknown */
+}
+
+/* add the drivers reported by sys_get_audio_apis()/sys_get_midi_apis() to <drivers> */
+static void apilist_parsedrivers(t_symkeys*drivers, const char*buf) {
+  t_apilist list;
+  t_apispan span;
+  apilist_init(&list, buf);
+  while(apilist_next(&list, &span)) {
+    char name[MAXPDSTRING];
+    apispan_getname(&span, name, sizeof(name));
+    symkeys_add(drivers, gensym(name), span.id, 0);
+  }
+  if(list.skipped)
+    verbose(1, "skipped %u unparseable driver(s) in '%s'", list.skipped, buf);
+}
+
+
+/**
+ * paramschema: a declarative description of the '@<param> <values>...' parameters
+ *
+ * each parameter has a keyword (plus aliases), a value type, a valid range
+ * and an apply target: the bit that is set in the 'changed' mask, and a
+ * function that writes the (validated) values into the class' parameter struct.
+ * the keywords are interned into a symkeys table once at class setup,
+ * so looking up a parameter is a single hash lookup.
+ */
+typedef enum {
+  PARAMTYPE_INT,      /* a single integer */
+  PARAMTYPE_BOOL,     /* a single 0/1 */
+  PARAMTYPE_POW2,     /* a single power of two */
+  PARAMTYPE_DEVICES,  /* a list of devices (ids or names) */
+  PARAMTYPE_DEVPAIRS, /* a list of <device> <channels> pairs */
+} t_paramtype;
+
+typedef struct _paramspec t_paramspec;
+/* writes the values (<argc> atoms up to the next parameter) into <params>
+ * returns 1 if they were accepted, 0 if they were rejected (leaving <params> untouched) */
+typedef int (*t_paramspec_fn)(const void*x, void*params, const t_paramspec*spec, int argc, t_atom*argv);
+
+struct _paramspec {
+  const char*keyword;    /* without the leading '@' */
+  const char*aliases[3]; /* NULL-terminated */
+  int target;            /* bit in the 'changed' mask */
+  t_paramtype type;
+  t_float min, max;      /* valid range of (each) value; no upper limit if max<min */
+  unsigned int maxcount; /* maximum number of list entries */
+  size_t offset;         /* PARAMTYPE_INT/BOOL: offsetof() the int member in the params */
+  t_paramspec_fn setfn;
+};
+
+/* the spec tables are indexed by target ('[PARAM_x]={...}'), so a spec can be looked up directly;
+ * this fails to compile if <specs> doesn't have exactly <count> entries */
+#define PARAMSCHEMA_CHECKSIZE(specs, count) \
+  typedef char specs##_checksize[(sizeof(specs)/sizeof(*specs)==(count))?1:-1]
+
+typedef struct _paramschema {
+  const t_paramspec*specs;
+  unsigned int count;
+  t_symkeys keywords; /* '@<keyword>' -> index into specs */
+} t_paramschema;
+
+static void paramschema_init(t_paramschema*schema, const t_paramspec*specs, const unsigned int count) {
+  char buf[MAXPDSTRING];
+  unsigned int i, j;
+  schema->specs=specs;
+  schema->count=count;
+  symkeys_init(&schema->keywords);
+  for(i=0; i<count; i++) {
+    snprintf(buf, MAXPDSTRING, "@%s", specs[i].keyword);
+    symkeys_add(&schema->keywords, gensym(buf), i, 0);
+    for(j=0; j<sizeof(specs[i].aliases)/sizeof(*specs[i].aliases) && specs[i].aliases[j]; j++) {
+      snprintf(buf, MAXPDSTRING, "@%s", specs[i].aliases[j]);
+      symkeys_add(&schema->keywords, gensym(buf), i, 0);
+    }
+  }
+}
+
+static void paramschema_free(t_paramschema*schema) {
+  symkeys_free(&schema->keywords);
+}
+
+static const t_paramspec*paramschema_find(const t_paramschema*schema, const t_symbol*s) {
+  int index=symkeys_getid(&schema->keywords, s);
+  if(index<0)
+    return NULL;
+  return schema->specs+index;
+}
+
+/* find the beginning of the next parameter in the list */
+static int paramschema_next(int argc, t_atom*argv) {
+  int i=0;
+  for(i=0; i<argc; i++) {
+    if(A_SYMBOL==argv[i].a_type) {
+      t_symbol*s=atom_getsymbol(argv+i);
+      if('@'==s->s_name[0])
+        return i;
+    }
+  }
+  return i;
+}
+
+/* check whether <value> is within the range of <spec> (complaining if not) */
+static int paramspec_check(const void*x, const t_paramspec*spec, const t_float value) {
+  if(value<spec->min || (spec->max>=spec->min && value>spec->max)) {
+    if(spec->max>=spec->min)
+      pd_error(x, "@%s: %g out of range [%g..%g]", spec->keyword, value, spec->min, spec->max);
+    else
+      pd_error(x, "@%s: %g out of range [%g..]", spec->keyword, value, spec->min);
+    return 0;
+  }
+  return 1;
+}
+
+/* parse '@<param> <values>...' into <params>
+ * returns the parameters that were accepted (as 1<<target) */
+static unsigned int paramschema_parse(const t_paramschema*schema, const void*x, void*params, int argc, t_atom*argv) {
+  unsigned int changed=0;
+  int advance=paramschema_next(argc, argv);
+  while((argc-=advance)>0) {
+    const t_paramspec*spec;
+    argv+=advance;
+    spec=paramschema_find(schema, atom_getsymbol(argv));
+
+    argv++;
+    argc--;
+
+    if(spec) {
+      if(spec->setfn(x, params, spec, argc, argv))
+        changed|=(1<<spec->target);
+    } else {
+      pd_error(x, "unknown parameter"); postatom(1, argv-1);endpost();
+    }
+
+    /* skip the values (whether they were accepted or not) */
+    advance=paramschema_next(argc, argv);
+  }
+  return changed;
+}
+
+
+/**
+ * timings: how long the calls into Pd's backends take
+ *
+ * each call keeps min/avg/max and the most recent durations (for the p99);
+ * calls may be timed from the probe threads, hence the mutex
+ */
+#define TIMING_NSAMPLES 256
+typedef struct _timing {
+  const char*name;
+  unsigned long count;
+  double min, max, sum; /* msec */
+  double samples[TIMING_NSAMPLES]; /* ring buffer */
+} t_timing;
+
+static pthread_mutex_t timing_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void timing_init(t_timing*timings, const char*const*names, const unsigned int count) {
+  unsigned int i;
+  memset(timings, 0, count*sizeof(*timings));
+  for(i=0; i<count; i++)
+    timings[i].name=names[i];
+}
+
+/* a monotonic clock in msec */
+static double timing_now(void) {
+#ifdef CLOCK_MONOTONIC
+  struct timespec ts;
+  if(!clock_gettime(CLOCK_MONOTONIC, &ts))
+    return ts.tv_sec*1000. + ts.tv_nsec/1000000.;
+#endif
+  return sys_getrealtime()*1000.;
+}
+
+static void timing_stop(t_timing*timing, const double start) {
+  double msec=timing_now()-start;
+  pthread_mutex_lock(&timing_mutex);
+  if(!timing->count || msec<timing->min)
+    timing->min=msec;
+  if(!timing->count || msec>timing->max)
+    timing->max=msec;
+  timing->sum+=msec;
+  timing->samples[timing->count%TIMING_NSAMPLES]=msec;
+  timing->count++;
+  pthread_mutex_unlock(&timing_mutex);
+}
+
+static int timing_compare(const void*a, const void*b) {
+  const double da=*(const double*)a, db=*(const double*)b;
+  return (da>db) - (da<db);
+}
+
+/* a consistent copy of the stats: <result> = {count, min, avg, max, p99} */
+static void timing_get(const t_timing*timing, double result[5]) {
+  double samples[TIMING_NSAMPLES];
+  unsigned int n;
+  pthread_mutex_lock(&timing_mutex);
+  n=(timing->count<TIMING_NSAMPLES)?timing->count:TIMING_NSAMPLES;
+  memcpy(samples, timing->samples, n*sizeof(*samples));
+  result[0]=timing->count;
+  result[1]=timing->min;
+  result[2]=timing->count?(timing->sum/timing->count):0;
+  result[3]=timing->max;
+  pthread_mutex_unlock(&timing_mutex);
+
+  qsort(samples, n, sizeof(*samples), timing_compare);
+  result[4]=n?samples[(n*99-1)/100]:0;
+}
+
+/* 'timings <call> <count> <min> <avg> <max> <p99>' (msec) */
+static void timing_output(t_outlet*outlet, const t_timing*timings, const unsigned int count) {
+  unsigned int i, j;
+  for(i=0; i<count; i++) {
+    double result[5];
+    t_atom atoms[6];
+    timing_get(timings+i, result);
+    SETSYMBOL(atoms+0, gensym(timings[i].name));
+    for(j=0; j<5; j++)
+      SETFLOAT(atoms+1+j, (t_float)result[j]);
+    outlet_anything(outlet, gensym("timings"), 6, atoms);
+  }
+}
+static void timing_post(const t_timing*timings, const unsigned int count) {
+  unsigned int i;
+  post("timings [msec]: count min/avg/max p99");
+  for(i=0; i<count; i++) {
+    double result[5];
+    timing_get(timings+i, result);
+    post("\t%s: %d %.3f/%.3f/%.3f %.3f", timings[i].name,
+         (int)result[0], result[1], result[2], result[3], result[4]);
+  }
+}
+
+
+/**
+ * devindex: lower-cased device names sorted alphabetically,
+ * so devices can be selected by (a prefix or a part of) their name
+ * it is (re)built once for each enumeration
+ */
+typedef struct _devname {
+  char*name; /* lower-cased */
+  size_t size;
+  int id;
+} t_devname;
+typedef struct _devindex {
+  t_devname*entries;
+  unsigned int count, size;
+} t_devindex;
+
+#define DEVINDEX_NOTFOUND -1
+#define DEVINDEX_AMBIGUOUS -2
+
+static int devindex_compare(const void*a, const void*b) {
+  return strcmp(((const t_devname*)a)->name, ((const t_devname*)b)->name);
+}
+static char*devindex_lower(char*dest, const char*src, size_t size) {
+  size_t i;
+  for(i=0; i+1<size && src[i]; i++)
+    dest[i]=tolower((unsigned char)src[i]);
+  dest[i]=0;
+  return dest;
+}
+static void devindex_clear(t_devindex*index) {
+  unsigned int i;
+  for(i=0; i<index->count; i++)
+    freebytes(index->entries[i].name, index->entries[i].size);
+  index->count=0;
+}
+static void devindex_free(t_devindex*index) {
+  devindex_clear(index);
+  if(index->entries)
+    freebytes(index->entries, index->size*sizeof(*index->entries));
+  index->entries=0;
+  index->size=0;
+}
+static void devindex_build(t_devindex*index, const t_symkeys*keys) {
+  unsigned int i;
+  devindex_clear(index);
+  if(keys->count>index->size) {
+    index->entries=resizebytes(index->entries,
+                               index->size*sizeof(*index->entries),
+                               keys->count*sizeof(*index->entries));
+    index->size=keys->count;
+  }
+  for(i=0; i<keys->count; i++) {
+    t_devname*dev=index->entries+i;
+    dev->size=strlen(keys->entries[i].name->s_name)+1;
+    dev->name=getbytes(dev->size);
+    devindex_lower(dev->name, keys->entries[i].name->s_name, dev->size);
+    dev->id=keys->entries[i].id;
+  }
+  index->count=keys->count;
+  qsort(index->entries, index->count, sizeof(*index->entries), devindex_compare);
+}
+
+/* find a device by name:
+ * an exact match, else a unique (case-insensitive) prefix, else a unique (case-insensitive) substring
+ * returns the device-id, DEVINDEX_NOTFOUND or DEVINDEX_AMBIGUOUS
+ */
+static int devindex_find(const t_devindex*index, const t_symkeys*keys, const t_symbol*s) {
+  char name[MAXPDSTRING];
+  size_t len;
+  unsigned int lo=0, hi=index->count, i;
+  int id=symkeys_getid(keys, s);
+  if(id>=0)
+    return id;
+
+  devindex_lower(name, s->s_name, MAXPDSTRING);
+  len=strlen(name);
+
+  /* the first entry >= <name>: all entries with this prefix follow */
+  while(lo<hi) {
+    unsigned int mid=(lo+hi)/2;
+    if(strcmp(index->entries[mid].name, name)<0)
+      lo=mid+1;
+    else
+      hi=mid;
+  }
+  if(lo<index->count && !strncmp(index->entries[lo].name, name, len)) {
+    if(!index->entries[lo].name[len])
+      return index->entries[lo].id; /* case-insensitive exact match */
+    if(lo+1<index->count && !strncmp(index->entries[lo+1].name, name, len))
+      return DEVINDEX_AMBIGUOUS;
+    return index->entries[lo].id;
+  }
+
+  id=DEVINDEX_NOTFOUND;
+  for(i=0; i<index->count; i++) {
+    if(strstr(index->entries[i].name, name)) {
+      if(id!=DEVINDEX_NOTFOUND)
+        return DEVINDEX_AMBIGUOUS;
+      id=index->entries[i].id;
+    }
+  }
+  return id;
+}
+
+
+/**
+ * profiles: named snapshots of the settings, stored as Pd messages
+ * ('<keyword> <values>...;' per line) in '<name>.<ext>' next to the patch
+ * (unless <name> is an absolute path, which is used as is)
+ */
+static void profile_path(t_symbol*name, const t_canvas*canvas, const char*ext,
+                         char*file, size_t filesize, const char**dir) {
+  if(sys_isabsolutepath(name->s_name)) {
+    snprintf(file, filesize, "%s", name->s_name);
+    *dir="";
+  } else {
+    snprintf(file, filesize, "%s.%s", name->s_name, ext);
+    *dir=canvas?canvas_getdir(canvas)->s_name:"";
+  }
+  file[filesize-1]=0;
+}
+
+/* call <msgfn> for each message in <b>
+ * (with the first atom as selector) */
+typedef void (*t_profile_fn)(void*owner, t_symbol*s, int argc, t_atom*argv);
+static void profile_foreach(t_binbuf*b, t_profile_fn msgfn, void*owner) {
+  int argc=binbuf_getnatom(b);
+  t_atom*argv=binbuf_getvec(b);
+  int start=0, i;
+  for(i=0; i<=argc; i++) {
+    if(i<argc && A_SEMI!=argv[i].a_type)
+      continue;
+    if(i>start && A_SYMBOL==argv[start].a_type)
+      msgfn(owner, atom_getsymbol(argv+start), i-start-1, argv+start+1);
+    start=i+1;
+  }
+}
+
+/* parse a single 'keyword <values>...' profile line as '@keyword <values>...' */
+static unsigned int profile_parseparam(const t_paramschema*schema, const void*x, void*params,
+                                       t_symbol*s, int argc, t_atom*argv) {
+  char buf[MAXPDSTRING];
+  const t_paramspec*spec;
+  snprintf(buf, MAXPDSTRING, "@%s", s->s_name);
+  buf[MAXPDSTRING-1]=0;
+  spec=paramschema_find(schema, gensym(buf));
+  if(!spec) {
+    pd_error(x, "ignoring unknown setting '%s' in profile", s->s_name);
+    return 0;
+  }
+  if(!spec->setfn(x, params, spec, argc, argv)) {
+    pd_error(x, "ignoring invalid setting '%s' in profile", s->s_name);
+    return 0;
+  }
+  return (1<<spec->target);
+}
+
+
+/* ------------------------- per-Pd-instance state ------------------------- */
+/* libpd can run several Pd-instances in a single process, each with its own
+ * symbols and scheduler: anything that holds symbols or clocks is therefore
+ * kept per instance (and only created when it is first needed)
+ * the state struct of a class starts with a t_msinstance (like a t_object)
+ *
+ * the state lives as long as there are objects of the class in the Pd-instance:
+ * each object holds a reference (msinstance_acquire() in its constructor,
+ * msinstance_release() in its destructor), and the last one to go tears the state down,
+ * so a new Pd-instance (even at the same address) always starts afresh
+ */
+#ifdef PDINSTANCE
+# define MSINSTANCE_CURRENT ((const void*)pd_this)
+#else
+# define MSINSTANCE_CURRENT ((const void*)0)
+#endif
+typedef struct _msinstance {
+  const void*pd;
+  unsigned int refcount; /* objects using this state */
+  struct _msinstance*next;
+} t_msinstance;
+typedef void (*t_msinstance_initfn)(t_msinstance*inst);
+typedef void (*t_msinstance_freefn)(t_msinstance*inst);
+static pthread_mutex_t msinstance_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* the state for the current Pd-instance (created by <initfn> on first use) */
+static t_msinstance*msinstance_get(t_msinstance**registry, size_t size, t_msinstance_initfn initfn) {
+  const void*pd=MSINSTANCE_CURRENT;
+  t_msinstance*inst;
+  pthread_mutex_lock(&msinstance_mutex);
+  for(inst=*registry; inst; inst=inst->next) {
+    if(pd == inst->pd)
+      break;
+  }
+  if(!inst) {
+    inst=(t_msinstance*)getbytes(size);
+    inst->pd=pd;
+    initfn(inst);
+    inst->next=*registry;
+    *registry=inst;
+  }
+  pthread_mutex_unlock(&msinstance_mutex);
+  return inst;
+}
+static void msinstance_acquire(t_msinstance*inst) {
+  pthread_mutex_lock(&msinstance_mutex);
+  inst->refcount++;
+  pthread_mutex_unlock(&msinstance_mutex);
+}
+/* drops a reference; if it was the last one, <freefn> releases the resources of <inst>
+ * (with the Pd-lock held: it has to stop the worker threads and free the clocks) */
+static void msinstance_release(t_msinstance**registry, t_msinstance*inst, size_t size, t_msinstance_freefn freefn) {
+  t_msinstance**entry;
+  pthread_mutex_lock(&msinstance_mutex);
+  if(inst->refcount && --inst->refcount) {
+    pthread_mutex_unlock(&msinstance_mutex);
+    return;
+  }
+  for(entry=registry; *entry; entry=&(*entry)->next) {
+    if(inst == *entry) {
+      *entry=inst->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&msinstance_mutex);
+  freefn(inst);
+  freebytes(inst, size);
+}
+
+/* make the Pd-instance of <inst> the current one
+ * (worker threads must do so before they sys_lock() and call back into Pd) */
+static void msinstance_set(const t_msinstance*inst) {
+#ifdef PDINSTANCE
+  pd_setinstance((t_pdinstance*)inst->pd);
+#else
+  (void)inst;
+#endif
+}
+
+
+/**
+ * devcache: the result of the last device enumeration
+ *
+ * probing the hardware can take quite some time, so we only do it
+ * if the cache has been invalidated (by bumping its generation counter),
+ * or if the driver has changed behind our back
+ * (audio and MIDI have a cache each, so they don't invalidate each other)
  */
-unsigned int findEOT(const char*s, unsigned int length) {
-  unsigned int len=0;
-  do {
-    char c=s[len];
-    len++;
-    switch(c) {
-    case '{':
-      len+=findEOT(s+len, length-len);
+typedef struct _devcache {
+  unsigned int generation;  /* bumped whenever the cache is invalidated */
+  unsigned int filled;      /* the generation the cache was filled in */
+  int valid;                /* the cache has been filled at all */
+  int api;
+  t_symkeys indevs, outdevs; /* device-name -> device-id */
+  t_devindex inindex, outindex;
+  int canmulti, cancallback;
+} t_devcache;
+
+static void devcache_invalidate(t_devcache*cache) {
+  cache->generation++;
+}
+static void devcache_free(t_devcache*cache) {
+  symkeys_free(&cache->indevs);
+  symkeys_free(&cache->outdevs);
+  devindex_free(&cache->inindex);
+  devindex_free(&cache->outindex);
+  cache->valid=0;
+}
+static int devcache_isvalid(const t_devcache*cache, const int api) {
+  return cache->valid && (cache->generation == cache->filled) && (api == cache->api);
+}
+/* fill from a list of <numdevs> strings of <devdescsize> bytes each */
+static void devcache_setdevs(t_symkeys*keys,
+                             const char*devlist, int numdevs, int devdescsize,
+                             int firstid) {
+  int i;
+  symkeys_clear(keys);
+  for(i=0; i<numdevs; i++) {
+    symkeys_add(keys, gensym(devlist+i*devdescsize), firstid+i, 1);
+  }
+}
+
+
+/**
+ * devprobe: enumerate devices in a worker thread
+ *
+ * probefn() runs in the worker thread and must not touch Pd
+ * (apart from the sys_get_*_devs() call itself),
+ * donefn() is called afterwards from the worker thread with the Pd-lock held
+ * (and the Pd-instance the probe belongs to made current)
+ *
+ * sys_get_*_devs() is called without the Pd-lock: we assume that the backends
+ * only touch the lists they are given (and their own driver state), but not that
+ * they can enumerate from two threads at once. so all enumerations (in worker
+ * threads as well as synchronous ones in the main thread) are serialised with
+ * devprobe_mutex, shared by all objects and Pd-instances of the class.
+ * (the two classes are built separately, but they call different backends)
+ *
+ * the device lists are heap buffers of <maxndev> entries of <devdescsize> bytes,
+ * that are kept between probes; if the backend fills them completely,
+ * they are enlarged and the enumeration is repeated
+ */
+typedef struct _devprobe t_devprobe;
+typedef void (*t_devprobe_fn)(t_devprobe*probe);
+typedef void (*t_devprobe_donefn)(void*owner, t_devprobe*probe);
+
+struct _devprobe {
+  t_msinstance*instance; /* the shared state (of the Pd-instance) the result is for */
+  void*owner;
+  t_devprobe_fn probefn;
+  t_devprobe_donefn donefn;
+
+  pthread_t thread;
+  int busy;     /* a thread has been started and not yet joined */
+  int done;     /* ...and it has finished */
+  int cancel;   /* the owner is going away: don't call donefn */
+
+  /* request */
+  int api;
+  unsigned int generation;
+
+  /* result */
+  char*indevlist, *outdevlist; /* t_char[maxndev][devdescsize] */
+  int maxndev, devdescsize;
+  int nindevs, noutdevs;
+  int canmulti, cancallback;
+};
+
+static pthread_mutex_t devprobe_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void devprobe_init(t_devprobe*probe, t_msinstance*instance, void*owner,
+                          t_devprobe_fn probefn, t_devprobe_donefn donefn) {
+  memset(probe, 0, sizeof(*probe));
+  probe->instance=instance;
+  probe->owner=owner;
+  probe->probefn=probefn;
+  probe->donefn=donefn;
+}
+
+/* (re)allocate the device lists, keeping them if they are large enough already */
+static void devprobe_reserve(t_devprobe*probe, int maxndev, int devdescsize) {
+  size_t oldsize=(size_t)probe->maxndev*probe->devdescsize;
+  size_t newsize=(size_t)maxndev*devdescsize;
+  if(probe->indevlist && newsize<=oldsize) {
+    probe->maxndev=maxndev;
+    probe->devdescsize=devdescsize;
+    return;
+  }
+  if(probe->indevlist) {
+    freebytes(probe->indevlist, oldsize);
+    freebytes(probe->outdevlist, oldsize);
+  }
+  probe->indevlist=getbytes(newsize);
+  probe->outdevlist=getbytes(newsize);
+  probe->maxndev=maxndev;
+  probe->devdescsize=devdescsize;
+}
+static void devprobe_free(t_devprobe*probe) {
+  if(probe->indevlist) {
+    size_t size=(size_t)probe->maxndev*probe->devdescsize;
+    freebytes(probe->indevlist, size);
+    freebytes(probe->outdevlist, size);
+  }
+  probe->indevlist=probe->outdevlist=0;
+  probe->maxndev=probe->devdescsize=0;
+}
+
+/* whether any of the <numdevs> names in <devlist> might have been cut off */
+static int devprobe_truncated(char*devlist, int numdevs, int devdescsize) {
+  int i;
+  for(i=0; i<numdevs; i++) {
+    char*name=devlist+i*devdescsize;
+    name[devdescsize-1]=0;
+    if(strlen(name)>=(size_t)(devdescsize-1))
+      return 1;
+  }
+  return 0;
+}
+
+/* run probefn() (repeatedly) until all devices fit into the lists */
+static void devprobe_run(t_devprobe*probe) {
+  int maxndev=(probe->maxndev>DEVPROBE_NDEV)?probe->maxndev:DEVPROBE_NDEV;
+  int devdescsize=(probe->devdescsize>DEVPROBE_DESCSIZE)?probe->devdescsize:DEVPROBE_DESCSIZE;
+  while(1) {
+    devprobe_reserve(probe, maxndev, devdescsize);
+    probe->nindevs=probe->noutdevs=0;
+    pthread_mutex_lock(&devprobe_mutex);
+    probe->probefn(probe);
+    pthread_mutex_unlock(&devprobe_mutex);
+
+    if((probe->nindevs>=maxndev || probe->noutdevs>=maxndev) && maxndev<DEVPROBE_MAXNDEV) {
+      maxndev*=2;
+    } else if((devprobe_truncated(probe->indevlist, probe->nindevs, devdescsize)
+               || devprobe_truncated(probe->outdevlist, probe->noutdevs, devdescsize))
+              && devdescsize<DEVPROBE_MAXDESCSIZE) {
+      devdescsize*=2;
+    } else {
       break;
-    case '}':
-      if('{'!=s[0])
-        return len;
-      else
-        return len-1;
-    case '\0':
-      return len;
     }
-  } while(len<length);
-  return len;
+  }
 }
 
+static void*devprobe_thread(void*arg) {
+  t_devprobe*probe=(t_devprobe*)arg;
+  devprobe_run(probe);
+
+  msinstance_set(probe->instance);
+  sys_lock();
+  if(!probe->cancel)
+    probe->donefn(probe->owner, probe);
+  probe->done=1;
+  sys_unlock();
+  return 0;
+}
+
+/* must be called with the Pd-lock held (the result is meant for <cache>).
+ * returns 0 if a probe is already running (its result will be delivered anyhow) */
+static int devprobe_start(t_devprobe*probe, const t_devcache*cache, const int api) {
+  if(probe->busy) {
+    if(!probe->done)
+      return 0;
+    pthread_join(probe->thread, 0);
+    probe->busy=0;
+  }
+  probe->api=api;
+  probe->generation=cache->generation;
+  probe->nindevs=probe->noutdevs=0;
+  probe->canmulti=probe->cancallback=0;
+  probe->done=probe->cancel=0;
+  if(pthread_create(&probe->thread, 0, devprobe_thread, probe))
+    return -1;
+  probe->busy=1;
+  return 1;
+}
+
+/* must be called with the Pd-lock held (e.g. from the owner's destructor) */
+static void devprobe_stop(t_devprobe*probe) {
+  if(!probe->busy)
+    return;
+  probe->cancel=1;
+  /* the thread might be waiting for the lock to deliver its result */
+  sys_unlock();
+  pthread_join(probe->thread, 0);
+  sys_lock();
+  probe->busy=0;
+}
+
+/* copy the result of a finished probe into the cache */
+static void devcache_setprobe(t_devcache*cache, const t_devprobe*probe, int firstid) {
+  devcache_setdevs(&cache->indevs , probe->indevlist , probe->nindevs , probe->devdescsize, firstid);
+  devcache_setdevs(&cache->outdevs, probe->outdevlist, probe->noutdevs, probe->devdescsize, firstid);
+  devindex_build(&cache->inindex , &cache->indevs );
+  devindex_build(&cache->outindex, &cache->outdevs);
+  cache->canmulti=probe->canmulti;
+  cache->cancallback=probe->cancallback;
+  cache->api=probe->api;
+  /* if the cache was invalidated while we were probing, the result is stale already */
+  cache->filled=probe->generation;
+  cache->valid=1;
+}
+
+
 /**
- * parse a string like "jack 3" into the name "jack" and the ID '3'
+ * diskcache: the driver list and the last enumeration, stored in a file
+ * so Pd can start without probing the hardware
+ *
+ * this is opt-in: set MEDIASETTINGS_CACHE to the directory for the cache files.
+ * the cache is only used if the fingerprint of the sound hardware is unchanged
+ * (on linux: the modification times of /proc/asound/cards and /dev/snd),
+ * and Pd's version (which determines the drivers)
+ *
+ * the files describe the hardware, so they are shared by all Pd-instances
+ * (and processes) on the host by design: the last enumeration wins.
+ * writes are serialised within the process, and replace the file atomically
  */
-static
-int common_parsedriver(const char*str, const int inlen, 
-                       char*name, int length, 
-                       int *id) {
-  /* find beginning of trailing number */
-  int stop=inlen-1;
-  int start1=0;
-  int stop1=0;
-  int start=0;
-  int ret=0;
-
-  while('\0'==str[stop] && stop>=0)
-    stop--;
-
-  start=stop;
-  while(start>=0) {
-    char c=str[start];
-    if(c<48 || c>=57) break;
-    start--;
-  }
-  if(start==stop || start<0)
-    return ret;
-
-  stop1=start;
-  while(stop1>=0) {
-    char c=str[stop1];
-    if(!isspace(c))
+#define DISKCACHE_ENV "MEDIASETTINGS_CACHE"
+
+static pthread_mutex_t diskcache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static const char*diskcache_dir(void) {
+  const char*dir=getenv(DISKCACHE_ENV);
+  return (dir && *dir)?dir:0;
+}
+
+/* returns 0 if there's no way to tell whether the hardware has changed */
+static int diskcache_fingerprint(char*buf, size_t size) {
+#ifdef __linux__
+  struct stat cards, snd;
+  int major=0, minor=0, bugfix=0;
+  if(stat("/proc/asound/cards", &cards) || stat("/dev/snd", &snd))
+    return 0;
+  sys_getversion(&major, &minor, &bugfix);
+  snprintf(buf, size, "pd%d.%d.%d:%ld:%ld", major, minor, bugfix,
+           (long)cards.st_mtime, (long)snd.st_mtime);
+  buf[size-1]=0;
+  return 1;
+#else
+  (void)buf;
+  (void)size;
+  return 0;
+#endif
+}
+
+static void diskcache_addkeys(t_binbuf*b, const char*sel, const t_symkeys*keys) {
+  unsigned int i;
+  binbuf_addv(b, "s", gensym(sel));
+  for(i=0; i<keys->count; i++)
+    binbuf_addv(b, "si", keys->entries[i].name, keys->entries[i].id);
+  binbuf_addsemi(b);
+}
+/* store <drivers> and <cache> in '<name>.cache' */
+static void diskcache_write(const char*name, const t_symkeys*drivers, const t_devcache*cache) {
+  char file[MAXPDSTRING], tmpfile[MAXPDSTRING], fingerprint[MAXPDSTRING];
+  const char*dir=diskcache_dir();
+  t_binbuf*b;
+  if(!dir || !diskcache_fingerprint(fingerprint, MAXPDSTRING))
+    return;
+  b=binbuf_new();
+  binbuf_addv(b, "ss;", gensym("fingerprint"), gensym(fingerprint));
+  diskcache_addkeys(b, "drivers", drivers);
+  binbuf_addv(b, "si;", gensym("api"), cache->api);
+  binbuf_addv(b, "sii;", gensym("flags"), cache->canmulti, cache->cancallback);
+  diskcache_addkeys(b, "in" , &cache->indevs);
+  diskcache_addkeys(b, "out", &cache->outdevs);
+  snprintf(file, MAXPDSTRING, "%s/%s.cache", dir, name);
+  file[MAXPDSTRING-1]=0;
+#ifdef __linux__
+  snprintf(tmpfile, MAXPDSTRING, "%s.cache.%ld", name, (long)getpid());
+#else
+  snprintf(tmpfile, MAXPDSTRING, "%s.cache.tmp", name);
+#endif
+  tmpfile[MAXPDSTRING-1]=0;
+
+  pthread_mutex_lock(&diskcache_mutex);
+  if(binbuf_write(b, tmpfile, dir, 0))
+    verbose(1, "unable to write cache '%s/%s'", dir, tmpfile);
+  else {
+    char path[MAXPDSTRING];
+    if(snprintf(path, MAXPDSTRING, "%s/%s", dir, tmpfile)>=MAXPDSTRING || rename(path, file))
+      verbose(1, "unable to write cache '%s'", file);
+  }
+  pthread_mutex_unlock(&diskcache_mutex);
+  binbuf_free(b);
+}
+
+typedef struct _diskcache {
+  int valid;  /* the fingerprint matches */
+  int api;    /* the enumerated api (or -1) */
+  t_symkeys*drivers;
+  t_devcache*cache;
+} t_diskcache;
+static void diskcache_readkeys(t_symkeys*keys, int argc, t_atom*argv) {
+  int i;
+  symkeys_clear(keys);
+  for(i=0; i+1<argc; i+=2)
+    symkeys_add(keys, atom_getsymbol(argv+i), atom_getint(argv+i+1), 0);
+}
+static void diskcache_readmsg(void*owner, t_symbol*s, int argc, t_atom*argv) {
+  t_diskcache*dc=(t_diskcache*)owner;
+  if(gensym("fingerprint")==s) {
+    char fingerprint[MAXPDSTRING];
+    dc->valid=diskcache_fingerprint(fingerprint, MAXPDSTRING)
+      && !strcmp(fingerprint, atom_getsymbolarg(0, argc, argv)->s_name);
+  }
+  if(!dc->valid)
+    return;
+  if(gensym("drivers")==s && dc->drivers)
+    diskcache_readkeys(dc->drivers, argc, argv);
+  else if(gensym("api")==s)
+    dc->api=atom_getintarg(0, argc, argv);
+  else if(gensym("flags")==s) {
+    dc->cache->canmulti=atom_getfloatarg(0, argc, argv);
+    dc->cache->cancallback=atom_getfloatarg(1, argc, argv);
+  } else if(gensym("in")==s)
+    diskcache_readkeys(&dc->cache->indevs, argc, argv);
+  else if(gensym("out")==s)
+    diskcache_readkeys(&dc->cache->outdevs, argc, argv);
+}
+/* fill <drivers> (unless NULL) and <cache> (if it was enumerated for <api>) from '<name>.cache'
+ * returns 0 if there is no (valid) cache, 1 if only the drivers were restored, 2 if both
+ */
+static int diskcache_read(const char*name, t_symkeys*drivers, t_devcache*cache, const int api) {
+  char file[MAXPDSTRING];
+  const char*dir=diskcache_dir();
+  t_devcache devices;
+  t_diskcache dc;
+  t_binbuf*b;
+  if(!dir)
+    return 0;
+  snprintf(file, MAXPDSTRING, "%s.cache", name);
+  file[MAXPDSTRING-1]=0;
+  b=binbuf_new();
+  if(binbuf_read(b, file, (char*)dir, 0)) {
+    binbuf_free(b);
+    return 0;
+  }
+  memset(&devices, 0, sizeof(devices));
+  dc.valid=0;
+  dc.api=-1;
+  dc.drivers=drivers;
+  dc.cache=&devices;
+  profile_foreach(b, diskcache_readmsg, &dc);
+  binbuf_free(b);
+
+  if(dc.valid && dc.api==api) {
+    symkeys_free(&cache->indevs);
+    symkeys_free(&cache->outdevs);
+    cache->indevs=devices.indevs;
+    cache->outdevs=devices.outdevs;
+    cache->canmulti=devices.canmulti;
+    cache->cancallback=devices.cancallback;
+    cache->api=api;
+    cache->filled=cache->generation;
+    cache->valid=1;
+    devindex_build(&cache->inindex , &cache->indevs );
+    devindex_build(&cache->outindex, &cache->outdevs);
+    return 2;
+  }
+  symkeys_free(&devices.indevs);
+  symkeys_free(&devices.outdevs);
+  return dc.valid;
+}
+
+
+
+
+/**
+ * hotplug: watch a directory (usually /dev/snd) for devices coming and going
+ *
+ * a worker thread sleeps until something in the directory is created or removed;
+ * it then invalidates the (owner's) device cache and calls eventfn() with the Pd-lock held
+ * (and the owner's Pd-instance made current)
+ */
+#define HOTPLUG_DEFAULTPATH "/dev/snd"
+
+typedef void (*t_hotplug_fn)(void*owner, t_symbol*event, t_symbol*name);
+
+typedef struct _hotplug {
+  t_msinstance*instance;
+  void*owner;
+  t_hotplug_fn eventfn;
+  t_devcache*cache;
+
+  pthread_t thread;
+  int running;
+  int fd;        /* inotify */
+  int wakeup[2]; /* writing to wakeup[1] stops the thread */
+} t_hotplug;
+
+static void hotplug_init(t_hotplug*hotplug, t_msinstance*instance, void*owner,
+                         t_devcache*cache, t_hotplug_fn eventfn) {
+  memset(hotplug, 0, sizeof(*hotplug));
+  hotplug->instance=instance;
+  hotplug->owner=owner;
+  hotplug->eventfn=eventfn;
+  hotplug->cache=cache;
+  hotplug->fd=hotplug->wakeup[0]=hotplug->wakeup[1]=-1;
+}
+
+#ifdef __linux__
+static void*hotplug_thread(void*arg) {
+  t_hotplug*hotplug=(t_hotplug*)arg;
+  char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+  while(1) {
+    struct pollfd fds[2];
+    ssize_t len;
+    char*ptr;
+    fds[0].fd=hotplug->fd;
+    fds[0].events=POLLIN;
+    fds[1].fd=hotplug->wakeup[0];
+    fds[1].events=POLLIN;
+
+    if(poll(fds, 2, -1)<0) {
+      if(EINTR==errno)continue;
       break;
-    stop1--;
+    }
+    if(fds[1].revents)
+      break;
+    if(!(fds[0].revents & POLLIN))
+      continue;
+
+    len=read(hotplug->fd, buf, sizeof(buf));
+    if(len<=0)
+      continue;
+
+    msinstance_set(hotplug->instance);
+    sys_lock();
+    devcache_invalidate(hotplug->cache);
+    for(ptr=buf; ptr<buf+len; ) {
+      const struct inotify_event*ev=(const struct inotify_event*)ptr;
+      ptr+=sizeof(struct inotify_event)+ev->len;
+      if(!ev->len)continue;
+      if(ev->mask & (IN_CREATE|IN_MOVED_TO))
+        hotplug->eventfn(hotplug->owner, gensym("added"), gensym(ev->name));
+      else if(ev->mask & (IN_DELETE|IN_MOVED_FROM))
+        hotplug->eventfn(hotplug->owner, gensym("removed"), gensym(ev->name));
+    }
+    sys_unlock();
   }
-  if(stop1<0)
-    return ret;
+  return 0;
+}
+#endif
 
-  if((   str[start1]=='"' && str[stop1]=='"') 
-     || (str[start1]=='\''  && str[stop1]=='\'')
-     || (str[start1]=='{'  && str[stop1]=='}')
-     ) {
-    start1++;
-    stop1--;
+/* must be called with the Pd-lock held */
+static void hotplug_stop(t_hotplug*hotplug) {
+#ifdef __linux__
+  if(hotplug->running) {
+    char c=0;
+    if(write(hotplug->wakeup[1], &c, 1)<0) {
+      /* the thread will wake up anyhow, once the pipe is closed */
+    }
+    /* the thread might be waiting for the lock to deliver an event */
+    sys_unlock();
+    pthread_join(hotplug->thread, 0);
+    sys_lock();
   }
-  stop1+=2;
-  if(stop1>=length)stop1=length-1;
-  snprintf(name, stop1-start1, "%s", str+start1);
-  ret=(1==sscanf(str+start, "%d", id));
+  if(hotplug->fd>=0)close(hotplug->fd);
+  if(hotplug->wakeup[0]>=0)close(hotplug->wakeup[0]);
+  if(hotplug->wakeup[1]>=0)close(hotplug->wakeup[1]);
+#endif
+  hotplug->running=0;
+  hotplug->fd=hotplug->wakeup[0]=hotplug->wakeup[1]=-1;
+}
 
-  return ret;
+/* returns 0 on success, or an error message */
+static const char*hotplug_start(t_hotplug*hotplug, const char*path) {
+#ifdef __linux__
+  hotplug_stop(hotplug);
+  hotplug->fd=inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+  if(hotplug->fd<0)
+    return strerror(errno);
+  if(inotify_add_watch(hotplug->fd, path,
+                       IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO)<0
+     || pipe(hotplug->wakeup)<0) {
+    const char*err=strerror(errno);
+    hotplug_stop(hotplug);
+    return err;
+  }
+  if(pthread_create(&hotplug->thread, 0, hotplug_thread, hotplug)) {
+    hotplug_stop(hotplug);
+    return "unable to start thread";
+  }
+  hotplug->running=1;
+  return 0;
+#else
+  (void)hotplug;
+  (void)path;
+  return "not supported on this platform";
+#endif
+}
+
+/* 'watch <onoff> [<directory>]' */
+static void hotplug_watch(t_hotplug*hotplug, const void*x, int argc, t_atom*argv) {
+  const char*path=HOTPLUG_DEFAULTPATH;
+  const char*err=0;
+  if(!argc || argc>2 || A_FLOAT!=argv->a_type) {
+    pd_error(x, "usage: watch <onoff> [<directory>]");
+    return;
+  }
+  if(!atom_getint(argv)) {
+    hotplug_stop(hotplug);
+    return;
+  }
+  if(argc>1)
+    path=atom_getsymbol(argv+1)->s_name;
+  err=hotplug_start(hotplug, path);
+  if(err)
+    pd_error(x, "unable to watch '%s': %s", path, err);
+}
+
+
+/**
+ * watchdog: periodically check whether the devices are alive,
+ * and if not, try to re-open them with exponential backoff
+ *
+ * checkfn() returns 1 if everything is fine,
+ * reopenfn() tries to recover (returns 1 on success),
+ * eventfn() reports 'down' (downtime=0) resp. 'recovered' (with the downtime in msec)
+ */
+#define WATCHDOG_INTERVAL 1000   /* msec between checks */
+#define WATCHDOG_MINBACKOFF 250  /* msec before the first retry */
+#define WATCHDOG_MAXBACKOFF 30000
+typedef int (*t_watchdog_fn)(void*owner);
+typedef void (*t_watchdog_eventfn)(void*owner, t_symbol*event, double downtime, int attempts);
+typedef struct _watchdog {
+  void*owner;
+  t_watchdog_fn checkfn, reopenfn;
+  t_watchdog_eventfn eventfn;
+  t_clock*clock;
+  int running;
+  int down;
+  double downsince; /* logical time */
+  double backoff;   /* msec */
+  int attempts;
+} t_watchdog;
+
+static void watchdog_tick(t_watchdog*wd) {
+  if(!wd->running)
+    return;
+  if(!wd->down) {
+    if(wd->checkfn(wd->owner)) {
+      clock_delay(wd->clock, WATCHDOG_INTERVAL);
+      return;
+    }
+    wd->down=1;
+    wd->downsince=clock_getlogicaltime();
+    wd->backoff=WATCHDOG_MINBACKOFF;
+    wd->attempts=0;
+    wd->eventfn(wd->owner, gensym("down"), 0, 0);
+  }
+  wd->attempts++;
+  if(wd->reopenfn(wd->owner) && wd->checkfn(wd->owner)) {
+    wd->down=0;
+    wd->eventfn(wd->owner, gensym("recovered"), clock_gettimesince(wd->downsince), wd->attempts);
+    clock_delay(wd->clock, WATCHDOG_INTERVAL);
+    return;
+  }
+  clock_delay(wd->clock, wd->backoff);
+  wd->backoff*=2;
+  if(wd->backoff>WATCHDOG_MAXBACKOFF)
+    wd->backoff=WATCHDOG_MAXBACKOFF;
+}
+static void watchdog_init(t_watchdog*wd, void*owner,
+                          t_watchdog_fn checkfn, t_watchdog_fn reopenfn, t_watchdog_eventfn eventfn) {
+  memset(wd, 0, sizeof(*wd));
+  wd->owner=owner;
+  wd->checkfn=checkfn;
+  wd->reopenfn=reopenfn;
+  wd->eventfn=eventfn;
+  wd->clock=clock_new(wd, (t_method)watchdog_tick);
+}
+static void watchdog_free(t_watchdog*wd) {
+  clock_free(wd->clock);
+  wd->clock=0;
+}
+/* 'watchdog <onoff>' */
+static void watchdog_set(t_watchdog*wd, const int onoff) {
+  wd->running=onoff;
+  wd->down=0;
+  clock_unset(wd->clock);
+  if(onoff)
+    clock_delay(wd->clock, WATCHDOG_INTERVAL);
 }
 
 
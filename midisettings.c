@@ -15,6 +15,7 @@
  *
  ******************************************************/
 #include "mediasettings.h"
+#include "alsaseq.h"
 
 #if (!defined MIDISETTINGS_VERSION) && (defined VERSION)
 # define MIDISETTINGS_VERSION VERSION
@@ -36,23 +37,51 @@
 extern int sys_midiapi;
 static t_class *midisettings_class;
 
-static t_symbol*s_pdsym=NULL;
-
-typedef struct _ms_symkeys {
-  t_symbol*name;
-  int      id;
-
-  struct _ms_symkeys *next;
-} t_ms_symkeys;
-
-typedef t_ms_symkeys t_ms_drivers ;
-
-
+/* the backend calls we keep timings for */
+enum {
+  TIMING_GET_APIS,
+  TIMING_GET_DEVS,
+  TIMING_CLOSE,
+  TIMING_REOPEN,
+  TIMING_DIALOG,
+  TIMING_SUBSCRIBE,
+  TIMING_COUNT
+};
+static const char*ms_timing_names[TIMING_COUNT] = {
+  "sys_get_midi_apis",
+  "sys_get_midi_devs",
+  "sys_close_midi",
+  "sys_reopen_midi",
+  "midi-dialog",
+  "snd_seq_(un)subscribe_port",
+};
+
+/* the state that is shared by all [midisettings] of a Pd-instance */
+typedef struct _ms_instance {
+  t_msinstance i_instance;
+  t_symbol*pdsym;
+  t_symkeys drivers;
+  t_devcache devices;       /* the devices of the current driver */
+  t_devprobe probe;         /* synchronous enumeration (the buffers are kept for the next time) */
+  t_devprobe diskprobe;     /* re-checks the devices restored from the disk cache */
+  t_paramschema params;
+  t_timing timings[TIMING_COUNT];
+#ifdef MEDIASETTINGS_ALSASEQ
+  t_alsaseq alsaseq;        /* snapshot of the ALSA sequencer ports */
+#endif
+} t_ms_instance;
+static t_msinstance*ms_instances=0;
+static void ms_instance_init(t_msinstance*inst);
+static void ms_instance_free(t_msinstance*inst);
+static t_ms_instance*ms_instance(void) {
+  return (t_ms_instance*)msinstance_get(&ms_instances, sizeof(t_ms_instance), ms_instance_init);
+}
 
-static void ms_symkeys_print(t_ms_symkeys*symkeys) {
-  while(symkeys) {
-    post("symkey[%s]=%d", (symkeys->name)?symkeys->name->s_name:"<nil>", symkeys->id);
-    symkeys=symkeys->next;
+static void ms_symkeys_print(const t_symkeys*symkeys) {
+  unsigned int i;
+  for(i=0; i<symkeys->count; i++) {
+    const t_symkey*symkey=symkeys->entries+i;
+    post("symkey[%s]=%d", (symkey->name)?symkey->name->s_name:"<nil>", symkey->id);
   }
 }
 
@@ -69,123 +98,8 @@ static const char*ms_defaultdrivername(const int id) {
   return NULL;
 }
 
-static t_ms_symkeys*ms_symkeys_find(t_ms_symkeys*symkeys, const t_symbol*name) {
-  while(symkeys) {
-    if(name==symkeys->name)return symkeys;
-    symkeys=symkeys->next;
-  }
-  return NULL;
-}
-
-static t_ms_symkeys*ms_symkeys_findid(t_ms_symkeys*symkeys, const int id) {
-  while(symkeys) {
-    if(id==symkeys->id)return symkeys;
-    symkeys=symkeys->next;
-  }
-  return NULL;
-}
-
-static t_ms_symkeys*ms_symkeys_add(t_ms_symkeys*symkeys, t_symbol*name, int id, int overwrite) {
-  t_ms_symkeys*symkey=ms_symkeys_find(symkeys, name);
-
-  if(symkey) {
-    char buf[MAXPDSTRING+1];
-    buf[MAXPDSTRING]=0;
-
-    if(!overwrite)
-      return symkeys;
-#warning LATER check how to deal with multiple devices of the same name!
-    // now this is a simple hack
-    snprintf(buf, MAXPDSTRING, "%s[%d]", name->s_name, id);
-    return ms_symkeys_add(symkeys, gensym(buf), id, overwrite);
-  }
-
-
-
-  symkey=(t_ms_symkeys*)getbytes(sizeof(t_ms_symkeys));
-  symkey->name=name;
-  symkey->id=id;
-  symkey->next=symkeys;
-
-  return symkey;
-}
-
-static void ms_symkeys_clear(t_ms_symkeys*symkeys) {
-  t_ms_symkeys*symkey=symkeys;
-  while(symkey) {
-    t_ms_symkeys*next=symkey->next;
-
-    symkey->name=NULL;
-    symkey->id=0;
-    symkey->next=NULL;
-
-    freebytes(symkey, sizeof(t_ms_symkeys));
-
-    symkey=next;
-  }
-}
-
-static t_symbol*ms_symkeys_getname(t_ms_symkeys*symkeys, const int id) {
-  t_ms_symkeys*driver=ms_symkeys_findid(symkeys, id);
-  if(driver)
-    return driver->name;
-  return NULL;
-}
-static int ms_symkeys_getid(t_ms_symkeys*symkeys, const t_symbol*name) {
-  t_ms_symkeys*symkey=ms_symkeys_find(symkeys, name);
-  if(symkey) {
-    return symkey->id;
-  }
-  return -1; /* unknown */
-}
-
-
-t_ms_symkeys*ms_driverparse(t_ms_symkeys*drivers, const char*buf) {
-  int start=-1;
-  int stop =-1;
-
-  unsigned int index=0;
-  int depth=0;
-  const char*s;
-  char substring[MAXPDSTRING];
-
-  for(index=0, s=buf; 0!=*s; s++, index++) {
-    if('{'==*s) {
-      start=index;
-      depth++;
-    }
-    if('}'==*s) {
-      depth--;
-      stop=index;
-
-      if(start>=0 && start<stop) {
-        char drivername[MAXPDSTRING];
-        int  driverid;
-        int length=stop-start;
-        if(length>=MAXPDSTRING)length=MAXPDSTRING-1;
-        snprintf(substring, length, "%s", buf+start+1);
-
-        if(common_parsedriver(substring, length,
-                              drivername, MAXPDSTRING,
-                              &driverid)) {
-          drivers=ms_symkeys_add(drivers, gensym(drivername), driverid, 0);
-        } else {
-          if((start+1)!=(stop)) /* empty APIs string */
-            post("unparseable: '%s'", substring);
-        }
-      }
-      start=-1;
-      stop=-1;
-    }
-  }
-
-  return drivers;
-}
-
-static t_ms_symkeys*DRIVERS=NULL;
-
 static t_symbol*ms_getdrivername(const int id) {
-  t_symbol*s=ms_symkeys_getname(DRIVERS, id);
+  t_symbol*s=symkeys_getname(&ms_instance()->drivers, id);
   if(s)
     return s;
   else {
@@ -197,7 +111,7 @@ static t_symbol*ms_getdrivername(const int id) {
 }
 
 static int ms_getdriverid(const t_symbol*id) {
-  return ms_symkeys_getid(DRIVERS, id);
+  return symkeys_getid(&ms_instance()->drivers, id);
 }
 
 
@@ -205,12 +119,9 @@ static int ms_getdriverid(const t_symbol*id) {
 typedef struct _ms_params {
   int indev[MAXMIDIINDEV], outdev[MAXMIDIOUTDEV];
   unsigned int num_indev, num_outdev;
-
-  t_ms_symkeys*indevices, *outdevices;
-  unsigned int num_indevices, num_outdevices;
 } t_ms_params;
 
-static void ms_params_print(t_ms_params*parms, const int terseness) {
+static void ms_params_print(const t_ms_params*parms, const int terseness) {
   int i=0;
 #if 0
   const int maxin =MAXMIDIINDEV;
@@ -234,93 +145,190 @@ static void ms_params_print(t_ms_params*parms, const int terseness) {
   verbose(terseness, ">=================================");
 }
 
-static t_ms_symkeys*ms_params_adddevices(
-  t_ms_symkeys*keys, unsigned int*number,
-  char devlist[MAXNDEV][DEVDESCSIZE], unsigned int numdevs) {
-  unsigned int num=0;
-  if(number)num=*number;
-  unsigned int i;
-  for(i=0; i<numdevs; i++) {
-    num++;
-    keys=ms_symkeys_add(keys, gensym(devlist[i]), num, 1);
+/* runs in the worker thread for async probes */
+static void ms_probe(t_devprobe*probe) {
+  double start=timing_now();
+  sys_get_midi_devs(probe->indevlist, &probe->nindevs,
+                    probe->outdevlist, &probe->noutdevs,
+                    probe->maxndev, probe->devdescsize);
+  timing_stop(((t_ms_instance*)probe->instance)->timings+TIMING_GET_DEVS, start);
+}
+
+/* sys_close_midi()/sys_reopen_midi() with timing */
+static void ms_close_midi(void) {
+  double start=timing_now();
+  sys_close_midi();
+  timing_stop(ms_instance()->timings+TIMING_CLOSE, start);
+}
+static void ms_reopen_midi(void) {
+  double start=timing_now();
+  sys_reopen_midi();
+  timing_stop(ms_instance()->timings+TIMING_REOPEN, start);
+}
+
+/* the disk cache (if enabled) is updated after each enumeration */
+static void ms_diskcache_save(const t_ms_instance*inst) {
+  diskcache_write("midisettings", &inst->drivers, &inst->devices);
+}
+
+static const t_devcache*ms_getdevices(void) {
+  t_ms_instance*inst=ms_instance();
+  t_devprobe*probe=&inst->probe;
+
+  if(devcache_isvalid(&inst->devices, sys_midiapi))
+    return &inst->devices;
+
+  if(!probe->probefn)
+    devprobe_init(probe, &inst->i_instance, 0, ms_probe, 0);
+  probe->api=sys_midiapi;
+  probe->generation=inst->devices.generation;
+  devprobe_run(probe);
+  devcache_setprobe(&inst->devices, probe, 1);
+  ms_diskcache_save(inst);
+
+  return &inst->devices;
+}
+
+/* restore the drivers and devices from the disk cache,
+ * and re-check the devices in the background
+ * returns 0 if the drivers still have to be queried
+ */
+static void ms_diskcache_done(void*owner, t_devprobe*probe) {
+  t_ms_instance*inst=(t_ms_instance*)probe->instance;
+  (void)owner;
+  devcache_setprobe(&inst->devices, probe, 1);
+  ms_diskcache_save(inst);
+}
+static int ms_diskcache_load(t_ms_instance*inst) {
+  int api=sys_midiapi;
+  int result=diskcache_read("midisettings", &inst->drivers, &inst->devices, api);
+  if(result>1) {
+    devprobe_init(&inst->diskprobe, &inst->i_instance, 0, ms_probe, ms_diskcache_done);
+    devprobe_start(&inst->diskprobe, &inst->devices, api);
   }
-  if(number)*number=num;
-  return keys;
+  return result;
 }
 
+/* device numbers are stored as in the 'midi-dialog' (1-based, 0=none),
+ * which is also how we number the entries in the device cache */
 static void ms_params_get(t_ms_params*parms) {
-  char indevlist[MAXNDEV][DEVDESCSIZE], outdevlist[MAXNDEV][DEVDESCSIZE];
   int indevs = 0, outdevs = 0;
+  int i;
 
-  ms_symkeys_clear(parms->indevices);
-  ms_symkeys_clear(parms->outdevices);
   memset(parms, 0, sizeof(t_ms_params));
 
-  sys_get_midi_devs((char*)indevlist, &indevs,
-                    (char*)outdevlist, &outdevs,
-                    MAXNDEV, DEVDESCSIZE);
-
-  parms->num_indevices=0;
-  parms->indevices=ms_params_adddevices(parms->indevices, &parms->num_indevices, indevlist, indevs);
-  parms->num_outdevices=0;
-  parms->outdevices=ms_params_adddevices(parms->outdevices, &parms->num_outdevices, outdevlist, outdevs);
-
   sys_get_midi_params(&indevs , parms->indev,
                       &outdevs, parms->outdev);
 
   parms->num_indev =(indevs >0)?indevs:0;
   parms->num_outdev=(outdevs>0)?outdevs:0;
+  for(i=0; i<indevs ; i++) parms->indev [i]++;
+  for(i=0; i<outdevs; i++) parms->outdev[i]++;
 
   // ms_params_print(parms, 0);
 }
 
+/* whether applying <a> would result in the same setup as <b> */
+static int ms_params_equal(const t_ms_params*a, const t_ms_params*b) {
+  unsigned int i;
+  if(a->num_indev!=b->num_indev || a->num_outdev!=b->num_outdev)
+    return 0;
+  if(API_ALSA == sys_midiapi) /* only the number of ports matters */
+    return 1;
+  for(i=0; i<a->num_indev; i++)
+    if(a->indev[i]!=b->indev[i])return 0;
+  for(i=0; i<a->num_outdev; i++)
+    if(a->outdev[i]!=b->outdev[i])return 0;
+  return 1;
+}
+
 
 typedef struct _midisettings
 {
   t_object x_obj;
   t_outlet*x_info;
 
+  t_devprobe x_probe;
+  t_hotplug x_hotplug;
   t_ms_params x_params;
-} t_midisettings;
 
-static void midisettings_params_init(t_midisettings*x) {
-  int i=0;
-  for(i=0; i<MAXMIDIINDEV ; i++) x->x_params.indev [i]=0;
-  for(i=0; i<MAXMIDIOUTDEV; i++) x->x_params.outdev[i]=0;
+  t_ms_params x_stage; /* accumulated by 'stage', applied by 'commit' */
+  int x_staged;
 
-  x->x_params.num_indev = x->x_params.num_outdev = 0;
+  int x_compact; /* output lists as single messages */
 
-  ms_params_get(&x->x_params);
+  t_canvas*x_canvas; /* profiles are relative to the patch */
+
+  t_watchdog x_watchdog;
+  t_ms_params x_wdparams; /* the watched setup */
+  t_symbol*x_wdindevs[MAXMIDIINDEV], *x_wdoutdevs[MAXMIDIOUTDEV]; /* ...and its devices by name */
+  t_devprobe x_wdprobe; /* the watchdog's own enumeration (leaving the device cache alone) */
+  t_symkeys x_wdinkeys, x_wdoutkeys;
+  int x_wdprobed; /* x_wdprobe has delivered a result that hasn't been looked at yet */
+} t_midisettings;
+
+static void midisettings_params_init(t_midisettings*x, t_ms_params*params) {
+  (void)x;
+  ms_params_get(params);
 }
 
 static void midisettings_debug(t_midisettings*x) {
-  post("IN-DEVS");ms_symkeys_print(x->x_params.indevices);
-  post("OUTDEVS");ms_symkeys_print(x->x_params.outdevices);
+  const t_devcache*devices=ms_getdevices();
+  (void)x;
+  post("IN-DEVS");ms_symkeys_print(&devices->indevs);
+  post("OUTDEVS");ms_symkeys_print(&devices->outdevs);
 
 }
 
 #define MS_ALSADEV_FORMAT "ALSA-%02d"
 
+/* re-take the snapshot of the ALSA sequencer ports (if needed)
+ * once per listing: ms_alsaportname() only looks at the snapshot */
+static void ms_alsaports_update(void) {
+#ifdef MEDIASETTINGS_ALSASEQ
+  t_ms_instance*inst=ms_instance();
+  if(API_ALSA == sys_midiapi)
+    alsaseq_update(&inst->alsaseq, inst->devices.generation);
+#endif
+}
+
+/* the name of Pd's <n>th ALSA-MIDI input resp. output port
+ * (made up, if the sequencer doesn't know about it) */
+static t_symbol*ms_alsaportname(int input, unsigned int n) {
+  char buf[MAXPDSTRING];
+#ifdef MEDIASETTINGS_ALSASEQ
+  const t_alsaseq*seq=&ms_instance()->alsaseq;
+  if(seq->valid) {
+    const t_alsaseq_port*port=alsaseq_pdport(seq, input, n);
+    if(port)
+      return port->name;
+  }
+#else
+  (void)input;
+#endif
+  snprintf(buf, MAXPDSTRING, MS_ALSADEV_FORMAT, n);
+  buf[MAXPDSTRING-1]=0;
+  return gensym(buf);
+}
+
 /* 'device in <devname1> <devname2> ...'
  * 'device out <devnameX> <deviceY> ...'
  */
 static int midisettings_listdevices_devices(
-  t_atom *atoms, /* MAXMIDIDEV+1 atoms */
+  t_atom *atoms, /* numdevs+1 atoms */
   t_symbol*type,
-  t_ms_symkeys*devices,
+  const t_symkeys*devices,
+  const int*devids,
   const unsigned int numdevs
   ) {
   unsigned int count=0, i=0;
   SETSYMBOL(atoms+0, type);
   for(i=0; i<numdevs; i++) {
-    char dummy[MAXPDSTRING];
     const char*devname=NULL;
     if(API_ALSA == sys_midiapi) {
-      snprintf(dummy, MAXPDSTRING, MS_ALSADEV_FORMAT, i);
-      dummy[MAXPDSTRING-1]=0;
-      devname=dummy;
+      devname=ms_alsaportname(gensym("in")==type, i)->s_name;
     } else {
-      t_symbol *s_devname=ms_symkeys_getname(devices, i);
+      t_symbol *s_devname=symkeys_getname(devices, devids[i]);
       if(s_devname) {
         devname=s_devname->s_name;
       }
@@ -337,34 +345,32 @@ static int midisettings_listdevices_devices(
  * 'devicelist out <numdevices>' + 'devicelist out <devName> <devId>'
  */
 static int midisettings_listdevices_devicelist(
-  t_atom*atoms, /* t_atom[MAXMIDIDEV*3] */
+  t_atom*atoms, /* t_atom[max(numdevs,maxdevs)*3] */
   t_symbol*type,
-  t_ms_symkeys*devices,
+  const t_symkeys*devices,
   const unsigned int numdevs,
   const unsigned int maxdevs
   ) {
   unsigned int i=0;
   int count = 0;
   if(API_ALSA == sys_midiapi) {
-    char dummy[MAXPDSTRING];
     for(i=0; i<maxdevs; i++) {
       t_atom*curatoms = atoms+3*count;
 
-      snprintf(dummy, MAXPDSTRING, MS_ALSADEV_FORMAT, i);
-      dummy[MAXPDSTRING-1]=0;
       SETSYMBOL(curatoms+0, type);
-      SETSYMBOL(curatoms+1, gensym(dummy));
+      SETSYMBOL(curatoms+1, ms_alsaportname(gensym("in")==type, i));
       SETFLOAT (curatoms+2, (t_float)i);
       count++;
     }
   } else {
-    for(i=0; i<numdevs && devices; i++, devices=devices->next) {
+    for(i=0; i<numdevs && i<devices->count; i++) {
+      const t_symkey*device=devices->entries+i;
       t_atom*curatoms = atoms + 3*count;
-      if(NULL==devices->name)
+      if(NULL==device->name)
         continue;
       SETSYMBOL(curatoms+0, type);
-      SETSYMBOL(curatoms+1, devices->name);
-      SETFLOAT (curatoms+2, (t_float)(devices->id));
+      SETSYMBOL(curatoms+1, device->name);
+      SETFLOAT (curatoms+2, (t_float)(device->id));
       count++;
     }
   }
@@ -372,57 +378,103 @@ static int midisettings_listdevices_devicelist(
 }
 
 
-static void midisettings_listdevices(t_midisettings *x)
+/* 'device <dir> <devname1> <devname2>...' */
+static void midisettings_output_devices(t_midisettings *x, const char*dir,
+                                        const t_symkeys*devices, const int*devids, unsigned int numdevs)
 {
-  t_atom indevices[MAXMIDIDEV+1], outdevices[MAXMIDIDEV+1];
-  t_atom indevlist[MAXMIDIDEV*3], outdevlist[MAXMIDIDEV*3];
-  t_atom devlenatoms[2];
-  int numindevices = 0, numoutdevices = 0;
-  int indevlistlen = 0, outdevlistlen = 0;
-  int i=0;
+  t_atom*atoms=(t_atom*)getbytes((numdevs+1)*sizeof(*atoms));
+  int count=midisettings_listdevices_devices(atoms, gensym(dir), devices, devids, numdevs);
+  outlet_anything(x->x_info, gensym("device"), count+1, atoms);
+  freebytes(atoms, (numdevs+1)*sizeof(*atoms));
+}
 
-  numindevices = midisettings_listdevices_devices(
-    indevices,
-    gensym("in"),
-    x->x_params.indevices,
-    x->x_params.num_indev);
+/* 'devicelist <dir> <numdevices>' + 'devicelist <dir> <devName> <devId>' (for each device)
+ * in compact mode: 'devicelist <dir> <devName0> <devId0> <devName1> <devId1>...'
+ */
+static void midisettings_output_devicelist(t_midisettings *x, const char*dir,
+                                           const t_symkeys*devices, unsigned int maxdevs)
+{
+  t_symbol*s_devicelist=gensym("devicelist");
+  unsigned int size=3*((devices->count>maxdevs)?devices->count:maxdevs)+1;
+  t_atom*atoms=(t_atom*)getbytes(size*sizeof(*atoms));
+  int len=midisettings_listdevices_devicelist(atoms, gensym(dir), devices, devices->count, maxdevs);
+  int i;
 
-  numoutdevices=midisettings_listdevices_devices(
-    outdevices,
-    gensym("out"),
-    x->x_params.outdevices,
-    x->x_params.num_outdev);
+  if(x->x_compact) {
+    /* <dir> <name> <id> <dir> <name> <id>... -> <dir> <name> <id> <name> <id>... */
+    for(i=0; i<len; i++) {
+      atoms[2*i+1]=atoms[3*i+1];
+      atoms[2*i+2]=atoms[3*i+2];
+    }
+    SETSYMBOL(atoms+0, gensym(dir));
+    outlet_anything(x->x_info, s_devicelist, 2*len+1, atoms);
+  } else {
+    t_atom devlenatoms[2];
+    SETSYMBOL(devlenatoms+0, gensym(dir)); SETFLOAT(devlenatoms+1, len);
+    outlet_anything(x->x_info, s_devicelist, 2, devlenatoms);
+    for(i=0; i<len; i++) {
+      outlet_anything(x->x_info, s_devicelist, 3, atoms+3*i);
+    }
+  }
+  freebytes(atoms, size*sizeof(*atoms));
+}
 
-  indevlistlen = midisettings_listdevices_devicelist(
-    indevlist,
-    gensym("in"),
-    x->x_params.indevices,
-    x->x_params.num_indevices,
-    MAXMIDIINDEV);
+static void midisettings_listdevices_output(t_midisettings *x, const t_devcache*devices)
+{
+  ms_alsaports_update();
+  midisettings_output_devices(x, "in" , &devices->indevs , x->x_params.indev , x->x_params.num_indev );
+  midisettings_output_devices(x, "out", &devices->outdevs, x->x_params.outdev, x->x_params.num_outdev);
+  midisettings_output_devicelist(x, "in" , &devices->indevs , MAXMIDIINDEV );
+  midisettings_output_devicelist(x, "out", &devices->outdevs, MAXMIDIOUTDEV);
+}
 
-  outdevlistlen = midisettings_listdevices_devicelist(
-    outdevlist,
-    gensym("out"),
-    x->x_params.outdevices,
-    x->x_params.num_outdevices,
-    MAXMIDIOUTDEV);
+static void midisettings_listdevices_finish(t_midisettings *x) {
+  t_atom ap[1];
+  SETSYMBOL(ap+0, gensym("listdevices"));
+  outlet_anything(x->x_info, gensym("done"), 1, ap);
+}
 
+/* called with the Pd-lock held, once the worker thread has finished probing */
+static void midisettings_listdevices_done(void*owner, t_devprobe*probe) {
+  t_midisettings *x=(t_midisettings *)owner;
+  t_ms_instance*inst=(t_ms_instance*)probe->instance;
+  devcache_setprobe(&inst->devices, probe, 1);
+  ms_diskcache_save(inst);
+  midisettings_listdevices_output(x, &inst->devices);
+  midisettings_listdevices_finish(x);
+}
 
-  outlet_anything(x->x_info, gensym("device"), numindevices +1, indevices);
-  outlet_anything(x->x_info, gensym("device"), numoutdevices+1, outdevices);
-  SETSYMBOL(devlenatoms+0, gensym("in")) ; SETFLOAT(devlenatoms+1,  indevlistlen);
-  outlet_anything(x->x_info, gensym("devicelist"), 2, devlenatoms);
-  for(i=0; i<indevlistlen; i++) {
-    outlet_anything(x->x_info, gensym("devicelist"), 3, indevlist+3*i);
+/* 'listdevices' outputs the devices right away,
+ * 'listdevices async' probes the devices in a worker thread (if needed),
+ * and outputs them later (followed by 'done listdevices')
+ */
+static void midisettings_listdevices(t_midisettings *x, t_symbol*s, int argc, t_atom*argv)
+{
+  int async=0;
+  (void)s;
+  if(argc && A_SYMBOL==argv->a_type && gensym("async")==atom_getsymbol(argv))
+    async=1;
+  else if (argc) {
+    pd_error(x, "usage: listdevices [async]");
+    return;
   }
-  SETSYMBOL(devlenatoms+0, gensym("out")); SETFLOAT(devlenatoms+1, outdevlistlen);
-  outlet_anything(x->x_info, gensym("devicelist"), 2, devlenatoms);
-  for(i=0; i<outdevlistlen; i++) {
-    outlet_anything(x->x_info, gensym("devicelist"), 3, outdevlist+3*i);
+
+  if(async) {
+    t_ms_instance*inst=ms_instance();
+    if(!devcache_isvalid(&inst->devices, sys_midiapi)) {
+      if(devprobe_start(&x->x_probe, &inst->devices, sys_midiapi)<0) {
+        pd_error(x, "unable to start device probe");
+      }
+      return;
+    }
+    midisettings_listdevices_output(x, &inst->devices);
+    midisettings_listdevices_finish(x);
+    return;
   }
+  midisettings_listdevices_output(x, ms_getdevices());
 }
 
-static void midisettings_params_apply(t_midisettings*x) {
+static void midisettings_params_apply(t_midisettings*x, const t_ms_params*params) {
 /*
   "pd midi-dialog ..."
   #00: indev[0]
@@ -444,14 +496,23 @@ static void midisettings_params_apply(t_midisettings*x) {
 # define MIDIDIALOG_OUTDEVS 4
 #endif
 
+  t_ms_instance*inst=ms_instance();
   int alsamidi=(API_ALSA==sys_midiapi);
 
   t_atom argv [MIDIDIALOG_INDEVS+MIDIDIALOG_OUTDEVS+2];
   unsigned int    argc= MIDIDIALOG_INDEVS+MIDIDIALOG_OUTDEVS+2;
 
   unsigned int i=0;
+  t_ms_params current;
 
-  ms_params_print(&x->x_params, 0);
+  ms_params_print(params, 0);
+
+  /* don't re-open the MIDI devices if nothing changes */
+  ms_params_get(&current);
+  if(ms_params_equal(params, &current)) {
+    verbose(1, "MIDI settings unchanged: not re-opening");
+    return;
+  }
 
   for(i=0; i<argc; i++) {
     SETFLOAT(argv+i, (t_float)0);
@@ -466,192 +527,190 @@ static void midisettings_params_apply(t_midisettings*x) {
       SETFLOAT(argv+i+1*MIDIDIALOG_INDEVS, (t_float)0);
     }
 
-    SETFLOAT(argv+1*MIDIDIALOG_INDEVS+1*MIDIDIALOG_OUTDEVS+0,(t_float)x->x_params.num_indev );
-    SETFLOAT(argv+1*MIDIDIALOG_INDEVS+1*MIDIDIALOG_OUTDEVS+1,(t_float)x->x_params.num_outdev);
+    SETFLOAT(argv+1*MIDIDIALOG_INDEVS+1*MIDIDIALOG_OUTDEVS+0,(t_float)params->num_indev );
+    SETFLOAT(argv+1*MIDIDIALOG_INDEVS+1*MIDIDIALOG_OUTDEVS+1,(t_float)params->num_outdev);
 
   } else {
     unsigned int pos=0;
-    for(i=0; i<x->x_params.num_indev; i++) {
+    if(params->num_indev>MIDIDIALOG_INDEVS || params->num_outdev>MIDIDIALOG_OUTDEVS)
+      pd_error(x, "this version of Pd only allows setting %d devices per direction", MIDIDIALOG_INDEVS);
+    for(i=0; i<params->num_indev && i<MIDIDIALOG_INDEVS; i++) {
       pos=i+0*MIDIDIALOG_INDEVS;
-      SETFLOAT(argv+pos, (t_float)x->x_params.indev[i]);
+      SETFLOAT(argv+pos, (t_float)params->indev[i]);
     }
-    for(i=0; i<x->x_params.num_indev; i++) {
+    for(i=0; i<params->num_outdev && i<MIDIDIALOG_OUTDEVS; i++) {
       pos=i+1*MIDIDIALOG_INDEVS;
-      SETFLOAT(argv+pos, (t_float)x->x_params.outdev[i]);
+      SETFLOAT(argv+pos, (t_float)params->outdev[i]);
     }
     pos=MIDIDIALOG_INDEVS+MIDIDIALOG_OUTDEVS;
-    SETFLOAT(argv+1*MIDIDIALOG_INDEVS+1*MIDIDIALOG_OUTDEVS+0,(t_float)x->x_params.num_indev );
-    SETFLOAT(argv+1*MIDIDIALOG_INDEVS+1*MIDIDIALOG_OUTDEVS+1,(t_float)x->x_params.num_outdev);
+    SETFLOAT(argv+1*MIDIDIALOG_INDEVS+1*MIDIDIALOG_OUTDEVS+0,(t_float)params->num_indev );
+    SETFLOAT(argv+1*MIDIDIALOG_INDEVS+1*MIDIDIALOG_OUTDEVS+1,(t_float)params->num_outdev);
   }
 
-  if (s_pdsym->s_thing) typedmess(s_pdsym->s_thing,
-				  gensym("midi-dialog"),
-				  argc,
-				  argv);
+  devcache_invalidate(&inst->devices);
+  if (inst->pdsym->s_thing) {
+    double start=timing_now();
+    typedmess(inst->pdsym->s_thing,
+              gensym("midi-dialog"),
+              argc,
+              argv);
+    timing_stop(ms_instance()->timings+TIMING_DIALOG, start);
+  }
 }
 
 
-/* find the beginning of the next parameter in the list */
+/* apply targets of the parameters (bits in the 'changed' mask) */
 typedef enum {
   PARAM_INPUT,
   PARAM_OUTPUT,
-  PARAM_INVALID
-} t_paramtype;
-static t_paramtype midisettings_setparams_id(t_symbol*s) {
-  if(gensym("@input")==s) {
-    return PARAM_INPUT;
-  } else if(gensym("@output")==s) {
-    return PARAM_OUTPUT;
-  } else if(gensym("@in")==s) {
-    return PARAM_INPUT;
-  } else if(gensym("@out")==s) {
-    return PARAM_OUTPUT;
-  }
+  PARAM_COUNT
+} t_ms_param;
 
-  return PARAM_INVALID;
+/* the device cache if it is valid already, without enumerating */
+static const t_devcache*ms_validdevices(void) {
+  const t_devcache*cache=&ms_instance()->devices;
+  return devcache_isvalid(cache, sys_midiapi)?cache:0;
 }
 
-/* find the beginning of the next parameter in the list */
-static int midisettings_setparams_next(int argc, t_atom*argv) {
-  int i=0;
-  for(i=0; i<argc; i++) {
-    if(A_SYMBOL==argv[i].a_type) {
-      t_symbol*s=atom_getsymbol(argv+i);
-      if('@'==s->s_name[0])
-	return i;
-    }
-  }
-  return i;
-}
-
-/* [<device1> [<deviceN>]*] ... */
+/* [<device1> [<deviceN>]*] ...
+ * if any of the devices is invalid, the whole list is rejected
+ * the devices are only enumerated if there is a name: numeric ids are checked against
+ * an already valid cache (or else left to Pd when the settings are applied) */
 static int midisettings_setparams_inout(
+  const void*x, const t_paramspec*spec,
   int argc, t_atom*argv,
-  t_ms_symkeys*devices, int*devicelist, unsigned int*numdevices,
-  const unsigned int maxnumdevices ) {
-  const unsigned int length=midisettings_setparams_next(argc, argv);
+  int output, int*devicelist, unsigned int*numdevices) {
+  const unsigned int length=paramschema_next(argc, argv);
   unsigned int len=length;
+  int devs[MAXMIDIDEV];
   unsigned int i;
+  const t_devcache*cache=0;
+  const t_devcache*known=(API_ALSA==sys_midiapi)?0:ms_validdevices(); /* ALSA ports are created on demand */
 
-  if(len>maxnumdevices)
-    len=maxnumdevices;
-
-  *numdevices = len;
+  if(len>spec->maxcount)
+    len=spec->maxcount;
 
   for(i=0; i<len; i++) {
     int dev=0;
+    t_symbol*name;
     switch(argv[i].a_type) {
     case A_FLOAT:
-      dev=atom_getint(argv);
+      dev=atom_getint(argv+i);
+      if(known && dev>0 && !symkeys_getname(output?&known->outdevs:&known->indevs, dev)) {
+        pd_error(x, "@%s: no device #%d", spec->keyword, dev);
+        return 0;
+      }
       break;
     case A_SYMBOL:
-      // LATER: get the device-id from the device-name
-      dev=ms_symkeys_getid(devices, atom_getsymbol(argv+i));
-      if(dev<0) dev=0;
+      name=atom_getsymbol(argv+i);
+      if(!cache)
+        cache=ms_getdevices();
+      if(output)
+        dev=devindex_find(&cache->outindex, &cache->outdevs, name);
+      else
+        dev=devindex_find(&cache->inindex , &cache->indevs , name);
+      if(DEVINDEX_AMBIGUOUS==dev) {
+        pd_error(x, "@%s: device name '%s' is ambiguous", spec->keyword, name->s_name);
+        return 0;
+      } else if(dev<0) {
+        pd_error(x, "@%s: no device matching '%s'", spec->keyword, name->s_name);
+        return 0;
+      }
       break;
     default:
-      continue;
+      pd_error(x, "@%s: expects a list of devices", spec->keyword);
+      return 0;
     }
-    devicelist[i]=dev;
+    if(!paramspec_check(x, spec, dev))
+      return 0;
+    devs[i]=dev;
   }
-  return length;
+
+  for(i=0; i<len; i++)
+    devicelist[i]=devs[i];
+  *numdevices = len;
+  return 1;
 }
 
-static int midisettings_setparams_input(t_midisettings*x, int argc, t_atom*argv) {
-  int advance =  midisettings_setparams_inout(
-    argc, argv,
-    x->x_params.indevices, x->x_params.indev, &x->x_params.num_indev, MAXMIDIINDEV);
-  return advance;
+static int midisettings_setparams_input(const void*x, void*params_, const t_paramspec*spec, int argc, t_atom*argv) {
+  t_ms_params*params=(t_ms_params*)params_;
+  return midisettings_setparams_inout(x, spec, argc, argv, 0, params->indev, &params->num_indev);
 }
 
-static int midisettings_setparams_output(t_midisettings*x, int argc, t_atom*argv) {
-  return  midisettings_setparams_inout(
-    argc, argv,
-    x->x_params.outdevices, x->x_params.outdev, &x->x_params.num_outdev, MAXMIDIOUTDEV);
+static int midisettings_setparams_output(const void*x, void*params_, const t_paramspec*spec, int argc, t_atom*argv) {
+  t_ms_params*params=(t_ms_params*)params_;
+  return midisettings_setparams_inout(x, spec, argc, argv, 1, params->outdev, &params->num_outdev);
 }
 
-static void midisettings_setparams(t_midisettings *x, t_symbol*s, int argc, t_atom*argv) {
+static const t_paramspec ms_paramspecs[] = {
+  /* keyword   aliases     target        type              min  max  maxcount       offset/setfn */
+  [PARAM_INPUT]=
+  {"input",  {"in", 0},  PARAM_INPUT,  PARAMTYPE_DEVICES, 0, -1, MAXMIDIINDEV,
+   0, midisettings_setparams_input},
+  [PARAM_OUTPUT]=
+  {"output", {"out", 0}, PARAM_OUTPUT, PARAMTYPE_DEVICES, 0, -1, MAXMIDIOUTDEV,
+   0, midisettings_setparams_output},
+};
+PARAMSCHEMA_CHECKSIZE(ms_paramspecs, PARAM_COUNT);
+
+/* parse '[in|out] <devices>...' resp. '@<param> <values>...' into <params> */
+static void midisettings_setparams_parse(t_midisettings *x, t_ms_params*params, int argc, t_atom*argv) {
 /*
- * PLAN:
- *   several messages that accumulate to a certain settings, and then "apply" them
- *
  * normal midi: list up to four devices (each direction)
  * alsa   midi: choose number of ports (each direction)
-
  */
-  int apply=1;
-  int advance=0;
-  t_paramtype param=PARAM_INVALID;
-
-  enum {
-    INPUT, OUTPUT, PARAM
-  } type;
+  const t_paramspec*spec=NULL;
 
-  type=PARAM;
-
-  if(!argc) {
-    midisettings_listdevices(x);
-    return;
-  }
-
-  if(A_SYMBOL == argv->a_type ) {
+  if(argc && A_SYMBOL == argv->a_type ) {
     t_symbol*tsym=atom_getsymbol(argv);
     if(gensym("in")==tsym)
-      type=INPUT;
+      spec=ms_paramspecs+PARAM_INPUT;
     else if(gensym("out")==tsym)
-      type=OUTPUT;
-
-    if(PARAM!=type) {
-      argc--;
-      argv++;
-    }
+      spec=ms_paramspecs+PARAM_OUTPUT;
   }
 
-  midisettings_params_init (x); /* re-initialize to what we got */
+  if(spec)
+    spec->setfn(x, params, spec, argc-1, argv+1);
+  else
+    paramschema_parse(&ms_instance()->params, x, params, argc, argv);
+}
 
+static void midisettings_setparams(t_midisettings *x, t_symbol*s, int argc, t_atom*argv) {
+  (void)s;
+  if(!argc) {
+    midisettings_listdevices(x, 0, 0, 0);
+    return;
+  }
 
-  switch(type) {
-  case INPUT:
-    midisettings_setparams_input(x, argc, argv);
-    break;
-  case OUTPUT:
-    midisettings_setparams_output(x, argc, argv);
-    break;
-  case PARAM:
-    advance=midisettings_setparams_next(argc, argv);
-    while((argc-=advance)>0) {
-      argv+=advance;
-      s=atom_getsymbol(argv);
-      param=midisettings_setparams_id(s);
-
-      argv++;
-      argc--;
-
-      switch(param) {
-      case PARAM_INPUT:
-        advance=midisettings_setparams_input(x, argc, argv);
-        break;
-      case PARAM_OUTPUT:
-        advance=midisettings_setparams_output(x, argc, argv);
-        break;
-      default:
-        pd_error(x, "unknown parameter %d:", param); postatom(1, argv);endpost();
-        break;
-      }
+  midisettings_params_init (x, &x->x_params); /* re-initialize to what we got */
+  midisettings_setparams_parse(x, &x->x_params, argc, argv);
+  midisettings_params_apply (x, &x->x_params);
+}
 
-      argc-=advance;
-      argv+=advance;
-      advance=midisettings_setparams_next(argc, argv);
-    }
-    break;
-  }
-  if(apply) {
-    midisettings_params_apply (x); /* re-initialize to what we got */
+/* several messages that accumulate to a certain setting, which is then applied at once:
+ * 'stage @in <devices>...' (repeatedly), followed by 'commit' (or 'discard')
+ */
+static void midisettings_stage(t_midisettings *x, t_symbol*s, int argc, t_atom*argv) {
+  (void)s;
+  if(!x->x_staged) {
+    midisettings_params_init (x, &x->x_stage);
+    x->x_staged=1;
   }
+  midisettings_setparams_parse(x, &x->x_stage, argc, argv);
+}
+static void midisettings_commit(t_midisettings *x) {
+  if(!x->x_staged)
+    return;
+  x->x_staged=0;
+  midisettings_params_apply(x, &x->x_stage);
+}
+static void midisettings_discard(t_midisettings *x) {
+  x->x_staged=0;
 }
 
 static void midisettings_listdrivers(t_midisettings *x);
 static void midisettings_setdriver(t_midisettings *x, t_symbol*s, int argc, t_atom*argv) {
+  t_ms_instance*inst=ms_instance();
   int id=-1;
   s=gensym("<unknown>"); /* just re-use the argument, which is not needed anyhow */
   switch(argc) {
@@ -668,7 +727,7 @@ static void midisettings_setdriver(t_midisettings *x, t_symbol*s, int argc, t_at
     }
   }
 
-  if(NULL==DRIVERS) {
+  if(!inst->drivers.count) {
     id=sys_midiapi;
   } else {
     id=ms_getdriverid(s);
@@ -678,71 +737,500 @@ static void midisettings_setdriver(t_midisettings *x, t_symbol*s, int argc, t_at
     }
     verbose(1, "setting driver '%s' (=%d)", s->s_name, id);
   }
-  sys_close_midi();
+  if(id==sys_midiapi) {
+    verbose(1, "MIDI driver '%s' already running", s->s_name);
+    return;
+  }
+  devcache_invalidate(&inst->devices);
+  ms_close_midi();
   sys_set_midi_api(id);
-  sys_reopen_midi();
+  ms_reopen_midi();
 }
 
 /*
  */
 static void midisettings_listdrivers(t_midisettings *x)
 {
-  t_ms_drivers*driver=NULL;
   t_atom a1[1];
   t_atom*adrivers=0;
-  size_t count=0;
-  for(driver=DRIVERS; driver; driver=driver->next) {
-    count++;
-  }
-  adrivers=getbytes(sizeof(t_atom) * (count+2));
-  if(adrivers) {
-    size_t i;
-    for(driver=DRIVERS, i=0; driver; driver=driver->next, i++) {
-      SETSYMBOL(adrivers+i*2+0, driver->name);
-      SETFLOAT (adrivers+i*2+1, (t_float)(driver->id));
-    }
+  const t_symkeys*drivers=&ms_instance()->drivers;
+  size_t count=drivers->count;
+  size_t i;
+  adrivers=getbytes(sizeof(t_atom) * (2*count+1));
+  for(i=0; i<count; i++) {
+    const t_symkey*driver=drivers->entries+i;
+    SETSYMBOL(adrivers+i*2+0, driver->name);
+    SETFLOAT (adrivers+i*2+1, (t_float)(driver->id));
   }
 
   SETSYMBOL(a1+0, ms_getdrivername(sys_midiapi));
   outlet_anything(x->x_info, gensym("driver"), 1, a1);
 
-  SETFLOAT(a1+0, count);
-  outlet_anything(x->x_info, gensym("driverlist"), 1, a1);
+  if(x->x_compact) {
+    /* 'driverlist <name0> <id0> <name1> <id1>...' */
+    outlet_anything(x->x_info, gensym("driverlist"), 2*count, adrivers);
+  } else {
+    SETFLOAT(a1+0, count);
+    outlet_anything(x->x_info, gensym("driverlist"), 1, a1);
 
-  if(adrivers) {
-    size_t i;
     for(i=0; i<count; i++) {
       outlet_anything(x->x_info, gensym("driverlist"), 2, adrivers+2*i);
     }
-    freebytes(adrivers, (sizeof(t_atom) * (count+2)));
+  }
+  freebytes(adrivers, (sizeof(t_atom) * (2*count+1)));
+}
+
+/* 'save <name>': store driver and devices (by name) as a profile */
+static void midisettings_save_devices(t_binbuf*b, const char*dir, const t_symkeys*devices,
+                                      unsigned int ndevs, const int*devs) {
+  unsigned int i;
+  binbuf_addv(b, "s", gensym(dir));
+  for(i=0; i<ndevs; i++) {
+    t_symbol*name=symkeys_getname(devices, devs[i]);
+    if(name)
+      binbuf_addv(b, "s", name);
+    else
+      binbuf_addv(b, "i", devs[i]);
+  }
+  binbuf_addsemi(b);
+}
+static void midisettings_save(t_midisettings *x, t_symbol*name) {
+  char file[MAXPDSTRING];
+  const char*dir;
+  t_binbuf*b=binbuf_new();
+  const t_devcache*devices=ms_getdevices();
+  t_ms_params params;
+  ms_params_get(&params);
+
+  binbuf_addv(b, "ss;", gensym("driver"), ms_getdrivername(sys_midiapi));
+  midisettings_save_devices(b, "input" , &devices->indevs , params.num_indev , params.indev );
+  midisettings_save_devices(b, "output", &devices->outdevs, params.num_outdev, params.outdev);
+
+  profile_path(name, x->x_canvas, "midisettings", file, MAXPDSTRING, &dir);
+  if(binbuf_write(b, file, dir, 0))
+    pd_error(x, "unable to save profile '%s'", file);
+  binbuf_free(b);
+}
+
+/* 'load <name>': restore a profile (with a single re-open)
+ * devices are looked up by name in the devices of the profile's driver */
+typedef struct _ms_profile {
+  t_midisettings*x;
+  t_ms_params params;
+  int api;
+} t_ms_profile;
+static void midisettings_load_driver(void*owner, t_symbol*s, int argc, t_atom*argv) {
+  t_ms_profile*profile=(t_ms_profile*)owner;
+  t_symbol*driver=atom_getsymbolarg(0, argc, argv);
+  int api;
+  if(gensym("driver")!=s)
+    return;
+  api=ms_getdriverid(driver);
+  if(api<0)
+    pd_error(profile->x, "profile uses unknown driver '%s': keeping the current one", driver->s_name);
+  else
+    profile->api=api;
+}
+static void midisettings_load_param(void*owner, t_symbol*s, int argc, t_atom*argv) {
+  t_ms_profile*profile=(t_ms_profile*)owner;
+  if(gensym("driver")==s)
+    return;
+  profile_parseparam(&ms_instance()->params, profile->x, &profile->params, s, argc, argv);
+}
+static void midisettings_load(t_midisettings *x, t_symbol*name) {
+  char file[MAXPDSTRING];
+  const char*dir;
+  t_binbuf*b=binbuf_new();
+  t_ms_profile profile;
+  t_ms_params current;
+  int switched;
+
+  profile_path(name, x->x_canvas, "midisettings", file, MAXPDSTRING, &dir);
+  if(binbuf_read(b, file, (char*)dir, 0)) {
+    pd_error(x, "unable to load profile '%s'", file);
+    binbuf_free(b);
+    return;
+  }
+
+  profile.x=x;
+  profile.api=sys_midiapi;
+  profile_foreach(b, midisettings_load_driver, &profile);
+
+  /* switch the driver without re-opening, so we can enumerate its devices */
+  switched=(profile.api!=sys_midiapi);
+  if(switched) {
+    devcache_invalidate(&ms_instance()->devices);
+    ms_close_midi();
+    sys_set_midi_api(profile.api);
+  }
+
+  midisettings_params_init(x, &profile.params);
+  profile_foreach(b, midisettings_load_param, &profile);
+  binbuf_free(b);
+
+  ms_params_get(&current);
+  if(switched && ms_params_equal(&profile.params, &current))
+    ms_reopen_midi(); /* the dialog would skip unchanged devices */
+  else
+    midisettings_params_apply(x, &profile.params);
+}
+
+/* 'watchdog 1': re-open the MIDI devices if one of them went away (and came back)
+ * Pd doesn't notice that a MIDI device is gone, so each check starts an enumeration
+ * in the background and looks at the result of the previous one on the next tick;
+ * this goes into the watchdog's own lists, so it neither invalidates the device cache
+ * (of all [midisettings]) nor rewrites the disk cache
+ * outputs 'watchdog down' and 'watchdog recovered <downtime> <attempts>'
+ */
+static void ms_watchdog_names(t_symbol**names, const t_symkeys*devices, unsigned int ndevs, const int*devs) {
+  unsigned int i;
+  for(i=0; i<ndevs; i++)
+    names[i]=symkeys_getname(devices, devs[i]);
+}
+/* look up the devices by name (they might have new ids); returns 0 if any of them is missing */
+static int ms_watchdog_resolve(t_symbol**names, const t_symkeys*devices, unsigned int ndevs, int*devs) {
+  unsigned int i;
+  for(i=0; i<ndevs; i++) {
+    int id;
+    if(!names[i])
+      continue;
+    id=symkeys_getid(devices, names[i]);
+    if(id<0)
+      return 0;
+    devs[i]=id;
+  }
+  return 1;
+}
+static void midisettings_watchdog_snapshot(t_midisettings *x) {
+  const t_devcache*devices=ms_getdevices();
+  ms_params_get(&x->x_wdparams);
+  memset(x->x_wdindevs , 0, sizeof(x->x_wdindevs ));
+  memset(x->x_wdoutdevs, 0, sizeof(x->x_wdoutdevs));
+  ms_watchdog_names(x->x_wdindevs , &devices->indevs , x->x_wdparams.num_indev , x->x_wdparams.indev );
+  ms_watchdog_names(x->x_wdoutdevs, &devices->outdevs, x->x_wdparams.num_outdev, x->x_wdparams.outdev);
+}
+/* called with the Pd-lock held when the background enumeration has finished */
+static void midisettings_watchdog_probed(void*owner, t_devprobe*probe) {
+  t_midisettings *x=(t_midisettings *)owner;
+  devcache_setdevs(&x->x_wdinkeys , probe->indevlist , probe->nindevs , probe->devdescsize, 1);
+  devcache_setdevs(&x->x_wdoutkeys, probe->outdevlist, probe->noutdevs, probe->devdescsize, 1);
+  x->x_wdprobed=1;
+}
+/* resolves the watched devices in the last finished enumeration (and starts the next one);
+ * returns -1 if there's no new result yet, else whether all of the devices are present */
+static int midisettings_watchdog_poll(t_midisettings *x, t_ms_params*params) {
+  int result=-1;
+  if(x->x_wdprobed) {
+    result=ms_watchdog_resolve(x->x_wdindevs , &x->x_wdinkeys , params->num_indev , params->indev )
+      && ms_watchdog_resolve(x->x_wdoutdevs, &x->x_wdoutkeys, params->num_outdev, params->outdev);
+    x->x_wdprobed=0;
+  }
+  devprobe_start(&x->x_wdprobe, &ms_instance()->devices, sys_midiapi);
+  return result;
+}
+static int midisettings_watchdog_check(void*owner) {
+  t_midisettings *x=(t_midisettings *)owner;
+  t_ms_params current, params;
+  if(API_ALSA == sys_midiapi)
+    return 1; /* virtual ports don't go away */
+
+  /* the setup has been changed (by someone else) */
+  ms_params_get(&current);
+  if(!ms_params_equal(&current, &x->x_wdparams))
+    midisettings_watchdog_snapshot(x);
+
+  params=x->x_wdparams;
+  return (midisettings_watchdog_poll(x, &params)!=0);
+}
+static int midisettings_watchdog_reopen(void*owner) {
+  t_midisettings *x=(t_midisettings *)owner;
+  t_ms_params params=x->x_wdparams, current;
+
+  if(midisettings_watchdog_poll(x, &params)<=0)
+    return 0; /* not back yet (or not enumerated yet) */
+
+  /* the devices did change, so the cache is stale now */
+  devcache_invalidate(&ms_instance()->devices);
+  ms_params_get(&current);
+  if(ms_params_equal(&params, &current)) {
+    ms_close_midi();
+    ms_reopen_midi();
+  } else {
+    midisettings_params_apply(x, &params);
+  }
+  x->x_wdparams=params;
+  return 1;
+}
+static void midisettings_watchdog_event(void*owner, t_symbol*event, double downtime, int attempts) {
+  t_midisettings *x=(t_midisettings *)owner;
+  t_atom atoms[3];
+  SETSYMBOL(atoms+0, event);
+  SETFLOAT (atoms+1, (t_float)downtime);
+  SETFLOAT (atoms+2, (t_float)attempts);
+  outlet_anything(x->x_info, gensym("watchdog"), (attempts>0)?3:1, atoms);
+}
+static void midisettings_watchdog(t_midisettings *x, t_floatarg f) {
+  if(f!=0) {
+    midisettings_watchdog_snapshot(x);
+    x->x_wdprobed=0; /* don't judge the new setup by an old enumeration */
+  }
+  watchdog_set(&x->x_watchdog, (f!=0));
+}
+
+/* ALSA sequencer ports (with ALSA-MIDI, Pd's ports have to be connected to them) */
+#ifdef MEDIASETTINGS_ALSASEQ
+static t_alsaseq*midisettings_alsaseq(t_midisettings*x) {
+  t_ms_instance*inst=ms_instance();
+  t_alsaseq*seq=&inst->alsaseq;
+  if(!alsaseq_update(seq, inst->devices.generation)) {
+    pd_error(x, "unable to open the ALSA sequencer");
+    return 0;
+  }
+  return seq;
+}
+#endif
+
+/* 'port <source|sink|duplex> <address> <name>' for each port, followed by 'done listports'
+ * ('source' ports can be connected to Pd's inputs, 'sink' ports to Pd's outputs)
+ */
+static void midisettings_listports(t_midisettings*x) {
+#ifdef MEDIASETTINGS_ALSASEQ
+  t_alsaseq*seq=midisettings_alsaseq(x);
+  unsigned int i;
+  t_atom ap[3];
+  if(!seq)
+    return;
+  for(i=0; i<seq->count; i++) {
+    const t_alsaseq_port*port=seq->ports+i;
+    int source=(port->caps & SND_SEQ_PORT_CAP_SUBS_READ )?1:0;
+    int sink  =(port->caps & SND_SEQ_PORT_CAP_SUBS_WRITE)?1:0;
+    SETSYMBOL(ap+0, gensym((source && sink)?"duplex":(source?"source":"sink")));
+    SETSYMBOL(ap+1, port->address);
+    SETSYMBOL(ap+2, port->name);
+    outlet_anything(x->x_info, gensym("port"), 3, ap);
+  }
+  SETSYMBOL(ap+0, gensym("listports"));
+  outlet_anything(x->x_info, gensym("done"), 1, ap);
+#else
+  pd_error(x, "compiled without ALSA sequencer support");
+#endif
+}
+
+/* 'connect <sender> <dest>' resp. 'disconnect <sender> <dest>' (like 'aconnect')
+ * ports are given as '<client>:<port>', '<client>' or (a unique part of) their name
+ */
+static void midisettings_connect(t_midisettings*x, t_symbol*s, int argc, t_atom*argv) {
+#ifdef MEDIASETTINGS_ALSASEQ
+  t_alsaseq*seq;
+  snd_seq_addr_t addr[2];
+  int connect=(gensym("connect")==s);
+  int i, err;
+  double start;
+  if(2!=argc) {
+    pd_error(x, "usage: %s <sender> <dest>", s->s_name);
+    return;
+  }
+  if(!(seq=midisettings_alsaseq(x)))
+    return;
+  for(i=0; i<2; i++) {
+    char name[MAXPDSTRING];
+    switch(alsaseq_resolve(seq, argv+i, addr+i)) {
+    case 0:
+      continue;
+    case DEVINDEX_AMBIGUOUS:
+      atom_string(argv+i, name, MAXPDSTRING);
+      pd_error(x, "%s: ambiguous port '%s'", s->s_name, name);
+      return;
+    default:
+      atom_string(argv+i, name, MAXPDSTRING);
+      pd_error(x, "%s: unknown port '%s'", s->s_name, name);
+      return;
+    }
+  }
+  start=timing_now();
+  err=alsaseq_connect(seq, addr+0, addr+1, connect);
+  timing_stop(ms_instance()->timings+TIMING_SUBSCRIBE, start);
+  if(-EEXIST == err)
+    return; /* already connected */
+  if(err<0)
+    pd_error(x, "%s %d:%d %d:%d failed: %s", s->s_name,
+             addr[0].client, addr[0].port, addr[1].client, addr[1].port, snd_strerror(err));
+#else
+  (void)argc; (void)argv;
+  pd_error(x, "%s: compiled without ALSA sequencer support", s->s_name);
+#endif
+}
+
+/* 'connection <sender> <dest>' for each connection from or to one of Pd's ports */
+#ifdef MEDIASETTINGS_ALSASEQ
+typedef struct _ms_connections {
+  t_midisettings*x;
+  int pdclient;
+} t_ms_connections;
+static void midisettings_connections_output(void*owner, const snd_seq_addr_t*sender, const snd_seq_addr_t*dest) {
+  t_ms_connections*conns=(t_ms_connections*)owner;
+  char buf[MAXPDSTRING];
+  t_atom ap[2];
+  if(sender->client != conns->pdclient && dest->client != conns->pdclient)
+    return;
+  snprintf(buf, MAXPDSTRING, "%d:%d", sender->client, sender->port);
+  SETSYMBOL(ap+0, gensym(buf));
+  snprintf(buf, MAXPDSTRING, "%d:%d", dest->client, dest->port);
+  SETSYMBOL(ap+1, gensym(buf));
+  outlet_anything(conns->x->x_info, gensym("connection"), 2, ap);
+}
+#endif
+static void midisettings_connections(t_midisettings*x) {
+#ifdef MEDIASETTINGS_ALSASEQ
+  t_alsaseq*seq=midisettings_alsaseq(x);
+  t_ms_connections conns;
+  unsigned int i;
+  if(!seq)
+    return;
+  conns.x=x;
+  conns.pdclient=seq->pdclient;
+  for(i=0; i<seq->count; i++) {
+    snd_seq_addr_t sender;
+    if(!(seq->ports[i].caps & SND_SEQ_PORT_CAP_SUBS_READ))
+      continue;
+    sender.client=(unsigned char)seq->ports[i].client;
+    sender.port=(unsigned char)seq->ports[i].port;
+    alsaseq_subscribers(seq, &sender, midisettings_connections_output, &conns);
+  }
+#else
+  pd_error(x, "compiled without ALSA sequencer support");
+#endif
+}
+
+/* 'timings <call> <count> <min> <avg> <max> <p99>' for each backend call (in msec) */
+static void midisettings_timings(t_midisettings *x) {
+  timing_output(x->x_info, ms_instance()->timings, TIMING_COUNT);
+}
+
+/* forget about the cached devices, so they are probed again on the next query */
+static void midisettings_refresh(t_midisettings *x) {
+  (void)x;
+  devcache_invalidate(&ms_instance()->devices);
+}
+
+/* 'added <name>' resp. 'removed <name>' whenever a device node comes or goes */
+static void midisettings_hotplug(void*owner, t_symbol*event, t_symbol*name) {
+  t_midisettings *x=(t_midisettings *)owner;
+  t_atom ap[1];
+  SETSYMBOL(ap+0, name);
+  outlet_anything(x->x_info, event, 1, ap);
+}
+static void midisettings_watch(t_midisettings *x, t_symbol*s, int argc, t_atom*argv) {
+  (void)s;
+  hotplug_watch(&x->x_hotplug, x, argc, argv);
+}
+
+/* 'compact 1': output lists as a single message (rather than one message per entry) */
+static void midisettings_compact(t_midisettings *x, t_floatarg f) {
+  x->x_compact=(f!=0);
+}
+
+/* query a single setting:
+ * 'get driver|drivers' (current driver resp. all available drivers)
+ * 'get in|out' (currently used devices)
+ * 'get in devices|out devices' (available devices)
+ */
+static void midisettings_get(t_midisettings *x, t_symbol*s, int argc, t_atom*argv) {
+  t_symbol*what=atom_getsymbolarg(0, argc, argv);
+  t_symbol*sub =atom_getsymbolarg(1, argc, argv);
+  (void)s;
+
+  if(gensym("in")==what || gensym("out")==what) {
+    int in=(gensym("in")==what);
+    const t_devcache*devices=ms_getdevices();
+    ms_alsaports_update();
+    if(gensym("devices")==sub) {
+      midisettings_output_devicelist(x, what->s_name,
+                                     in?&devices->indevs:&devices->outdevs,
+                                     in?MAXMIDIINDEV:MAXMIDIOUTDEV);
+      return;
+    }
+    ms_params_get(&x->x_params);
+    if(in)
+      midisettings_output_devices(x, "in" , &devices->indevs , x->x_params.indev , x->x_params.num_indev );
+    else
+      midisettings_output_devices(x, "out", &devices->outdevs, x->x_params.outdev, x->x_params.num_outdev);
+  } else if(gensym("driver")==what) {
+    t_atom a;
+    SETSYMBOL(&a, ms_getdrivername(sys_midiapi));
+    outlet_anything(x->x_info, gensym("driver"), 1, &a);
+  } else if(gensym("drivers")==what) {
+    midisettings_listdrivers(x);
+  } else {
+    pd_error(x, "unknown query '%s'", what->s_name);
   }
 }
 
 static void midisettings_bang(t_midisettings *x) {
   midisettings_listdrivers(x);
-  midisettings_listdevices(x);
+  midisettings_listdevices(x, 0, 0, 0);
 }
 
 
 static void midisettings_free(t_midisettings *x){
-#warning cleanup
-  (void)x;
+  hotplug_stop(&x->x_hotplug);
+  devprobe_stop(&x->x_probe);
+  devprobe_free(&x->x_probe);
+  watchdog_free(&x->x_watchdog);
+  devprobe_stop(&x->x_wdprobe);
+  devprobe_free(&x->x_wdprobe);
+  symkeys_free(&x->x_wdinkeys);
+  symkeys_free(&x->x_wdoutkeys);
+  msinstance_release(&ms_instances, &ms_instance()->i_instance, sizeof(t_ms_instance), ms_instance_free);
 }
 
 
+/* called (once per Pd-instance) when the first [midisettings] is created */
+static void ms_instance_init(t_msinstance*i) {
+  t_ms_instance*inst=(t_ms_instance*)i;
+  inst->pdsym=gensym("pd");
+  paramschema_init(&inst->params, ms_paramspecs, PARAM_COUNT);
+  timing_init(inst->timings, ms_timing_names, TIMING_COUNT);
+  if(!ms_diskcache_load(inst)) {
+    char buf[MAXPDSTRING];
+    double start=timing_now();
+    sys_get_midi_apis(buf);
+    timing_stop(inst->timings+TIMING_GET_APIS, start);
+    apilist_parsedrivers(&inst->drivers, buf);
+  }
+}
+/* called when the last [midisettings] of the Pd-instance is deleted */
+static void ms_instance_free(t_msinstance*i) {
+  t_ms_instance*inst=(t_ms_instance*)i;
+  devprobe_stop(&inst->diskprobe);
+  devprobe_free(&inst->diskprobe);
+  devprobe_free(&inst->probe);
+  symkeys_free(&inst->drivers);
+  devcache_free(&inst->devices);
+  paramschema_free(&inst->params);
+#ifdef MEDIASETTINGS_ALSASEQ
+  alsaseq_free(&inst->alsaseq);
+#endif
+}
+
 static void *midisettings_new(void)
 {
   t_midisettings *x = (t_midisettings *)pd_new(midisettings_class);
+  t_ms_instance*inst=ms_instance();
+  msinstance_acquire(&inst->i_instance);
   x->x_info=outlet_new(&x->x_obj, 0);
-
-  x->x_params.indevices=NULL;
-  x->x_params.outdevices=NULL;
-
-  char buf[MAXPDSTRING];
-  sys_get_midi_apis(buf);
-  DRIVERS=ms_driverparse(DRIVERS, buf);
-
-  midisettings_params_init (x); /* re-initialize to what we got */
+  x->x_canvas=canvas_getcurrent();
+  watchdog_init(&x->x_watchdog, x,
+                midisettings_watchdog_check, midisettings_watchdog_reopen, midisettings_watchdog_event);
+  devprobe_init(&x->x_wdprobe, &inst->i_instance, x, ms_probe, midisettings_watchdog_probed);
+  symkeys_init(&x->x_wdinkeys);
+  symkeys_init(&x->x_wdoutkeys);
+  devprobe_init(&x->x_probe, &inst->i_instance, x, ms_probe, midisettings_listdevices_done);
+  hotplug_init(&x->x_hotplug, &inst->i_instance, x, &inst->devices, midisettings_hotplug);
+
+  midisettings_params_init (x, &x->x_params); /* re-initialize to what we got */
+  x->x_staged=0;
+  x->x_compact=0;
 
   return (x);
 }
@@ -751,8 +1239,6 @@ static void midisettings_testdevices(t_midisettings *x);
 
 void midisettings_setup(void)
 {
-  s_pdsym=gensym("pd");
-
   mediasettings_boilerplate("[midisettings] midi settings manager",
 #ifdef MIDISETTINGS_VERSION
                             MIDISETTINGS_VERSION
@@ -769,10 +1255,26 @@ void midisettings_setup(void)
 
   class_addbang(midisettings_class, (t_method)midisettings_bang);
   class_addmethod(midisettings_class, (t_method)midisettings_listdrivers, gensym("listdrivers"), A_NULL);
-  class_addmethod(midisettings_class, (t_method)midisettings_listdevices, gensym("listdevices"), A_NULL);
+  class_addmethod(midisettings_class, (t_method)midisettings_listdevices, gensym("listdevices"), A_GIMME, A_NULL);
+  class_addmethod(midisettings_class, (t_method)midisettings_refresh, gensym("refresh"), A_NULL);
+  class_addmethod(midisettings_class, (t_method)midisettings_timings, gensym("timings"), A_NULL);
+  class_addmethod(midisettings_class, (t_method)midisettings_save, gensym("save"), A_SYMBOL, A_NULL);
+  class_addmethod(midisettings_class, (t_method)midisettings_load, gensym("load"), A_SYMBOL, A_NULL);
+  class_addmethod(midisettings_class, (t_method)midisettings_watchdog, gensym("watchdog"), A_FLOAT, A_NULL);
+  class_addmethod(midisettings_class, (t_method)midisettings_listports, gensym("listports"), A_NULL);
+  class_addmethod(midisettings_class, (t_method)midisettings_connect, gensym("connect"), A_GIMME, A_NULL);
+  class_addmethod(midisettings_class, (t_method)midisettings_connect, gensym("disconnect"), A_GIMME, A_NULL);
+  class_addmethod(midisettings_class, (t_method)midisettings_connections, gensym("connections"), A_NULL);
+  class_addmethod(midisettings_class, (t_method)midisettings_testdevices, gensym("testdevices"), A_NULL);
+  class_addmethod(midisettings_class, (t_method)midisettings_get, gensym("get"), A_GIMME, A_NULL);
+  class_addmethod(midisettings_class, (t_method)midisettings_compact, gensym("compact"), A_FLOAT, A_NULL);
+  class_addmethod(midisettings_class, (t_method)midisettings_watch, gensym("watch"), A_GIMME, A_NULL);
 
   class_addmethod(midisettings_class, (t_method)midisettings_setdriver, gensym("driver"), A_GIMME, A_NULL);
   class_addmethod(midisettings_class, (t_method)midisettings_setparams, gensym("device"), A_GIMME, A_NULL);
+  class_addmethod(midisettings_class, (t_method)midisettings_stage, gensym("stage"), A_GIMME, A_NULL);
+  class_addmethod(midisettings_class, (t_method)midisettings_commit, gensym("commit"), A_NULL);
+  class_addmethod(midisettings_class, (t_method)midisettings_discard, gensym("discard"), A_NULL);
 
   class_addmethod(midisettings_class, (t_method)midisettings_debug, gensym("print"), A_NULL);
 }
@@ -782,20 +1284,17 @@ void midisettings_setup(void)
 static void midisettings_testdevices(t_midisettings *x)
 {
   int i;
-
-  char indevlist[MAXNDEV][DEVDESCSIZE], outdevlist[MAXNDEV][DEVDESCSIZE];
-  int indevs = 0, outdevs = 0;
+  const t_devcache*devices=ms_getdevices();
   (void)x;
 
-  sys_get_midi_devs((char*)indevlist, &indevs, (char*)outdevlist, &outdevs, MAXNDEV, DEVDESCSIZE);
-
-  post("%d midi indevs", indevs);
-  for(i=0; i<indevs; i++)
-    post("\t#%02d: %s", i, indevlist[i]);
+  post("%d midi indevs", devices->indevs.count);
+  for(i=0; i<(int)devices->indevs.count; i++)
+    post("\t#%02d: %s", i, devices->indevs.entries[i].name->s_name);
 
-  post("%d midi outdevs", outdevs);
-  for(i=0; i<outdevs; i++)
-    post("\t#%02d: %s", i, outdevlist[i]);
+  post("%d midi outdevs", devices->outdevs.count);
+  for(i=0; i<(int)devices->outdevs.count; i++)
+    post("\t#%02d: %s", i, devices->outdevs.entries[i].name->s_name);
+  timing_post(ms_instance()->timings, TIMING_COUNT);
 
   endpost();
   int nmidiindev, midiindev[MAXMIDIINDEV];
@@ -805,10 +1304,10 @@ static void midisettings_testdevices(t_midisettings *x)
 
   post("%d midiindev (parms)", nmidiindev);
   for(i=0; i<nmidiindev; i++) {
-    post("\t#%02d: %d %d", i, midiindev[i]);
+    post("\t#%02d: %d", i, midiindev[i]);
   }
   post("%d midioutdev (parms)", nmidioutdev);
   for(i=0; i<nmidioutdev; i++) {
-    post("\t#%02d: %d %d", i, midioutdev[i]);
+    post("\t#%02d: %d", i, midioutdev[i]);
   }
 }